@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Compare the full and lean NimBLE builds: DRAM, stack heap and throughput.
+
+For each env (default esp32dev and bt_lean) this
+  1. builds it with a linker map and takes the static DRAM and the "nimble"
+     subsystem row from footprint.py,
+  2. flashes it (skip with --no-flash to measure whatever is on the board),
+  3. reads `/ble` over USB for the stack heap initBLE() measured and the MTU
+     the firmware asks for,
+  4. connects over BLE and writes --count messages of --size bytes, timing
+     each GATT write (with response) like load_gen.py does,
+then prints both side by side. The lean profile must not lose throughput:
+the script exits 1 if its write rate is more than --tolerance % below the
+full stack's.
+
+  SERIAL_PORT=/dev/cu.usbserial-0001 python3 src/ble_compare.py
+  python3 src/ble_compare.py --env esp32dev --env bt_lean --size 180 --count 50
+"""
+import argparse
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+import footprint
+import llm_loop
+
+try:
+    import serial
+except Exception:
+    serial = None
+
+STACK_RE = re.compile(r"\[BLE\] stack heap=(\d+) B roles=(\S+) .*pref_mtu=(\d+) mtu=(\d+)")
+
+
+def flash(env: str):
+    pio = shutil.which("pio") or shutil.which("platformio")
+    if not pio:
+        sys.exit("PlatformIO not found (pip install platformio)")
+    subprocess.run([pio, "run", "-d", footprint.ROOT, "-e", env, "-t", "upload"], check=True)
+
+
+def read_ble(port: str, baud: int, timeout: float = 5.0):
+    """Send /ble over USB and return the first [BLE] stack line's fields."""
+    with serial.Serial(port, baud, timeout=0.5) as ser:
+        try:
+            ser.dtr = False  # avoid auto-reset on USB-UART bridges
+            ser.rts = False
+        except Exception:
+            pass
+        ser.reset_input_buffer()
+        ser.write(b"/ble\n")
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            line = ser.readline().decode("ascii", "ignore")
+            m = STACK_RE.search(line)
+            if m:
+                return {"stack_heap": int(m.group(1)), "roles": m.group(2),
+                        "pref_mtu": int(m.group(3)), "mtu": int(m.group(4))}
+    return {}
+
+
+def throughput(size: int, count: int):
+    """Write `count` messages of `size` bytes over BLE; returns (B/s, p50 ms, max ms)."""
+    llm_loop._BLE_PERSIST = None
+    llm_loop.send_ble("")  # connect and subscribe
+    body = ("x" * (size - 1)) + "\n"
+    times = []
+    for _ in range(count):
+        llm_loop.send_ble(body)
+        times.append(llm_loop._BLE_PERSIST.last_write_ms)
+        time.sleep(0.05)
+    llm_loop._BLE_PERSIST.close()
+    llm_loop._BLE_PERSIST = None
+    total_s = sum(times) / 1000
+    times.sort()
+    return (size * count / total_s if total_s else 0.0), times[len(times) // 2], times[-1]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--env", action="append", help="envs to compare (default: esp32dev, bt_lean)")
+    ap.add_argument("--serial-port", default=llm_loop.SERIAL_PORT)
+    ap.add_argument("--baud", type=int, default=llm_loop.BAUD)
+    ap.add_argument("--size", type=int, default=180, help="bytes per message (182 fits one write at MTU 185)")
+    ap.add_argument("--count", type=int, default=40)
+    ap.add_argument("--no-flash", action="store_true", help="measure the firmware already on the board")
+    ap.add_argument("--boot-wait", type=float, default=6.0, help="seconds to let the board boot after flashing")
+    ap.add_argument("--tolerance", type=float, default=5.0, help="%% throughput loss allowed for the last env")
+    args = ap.parse_args()
+    envs = args.env or ["esp32dev", "bt_lean"]
+    if serial is None or not args.serial_port:
+        sys.exit("needs pyserial and SERIAL_PORT / --serial-port")
+    if llm_loop.BleakClient is None:
+        sys.exit("bleak not installed. Install with: pip install bleak")
+
+    rows = {}
+    for env in envs:
+        fp = footprint.build(footprint.ROOT, env)
+        if not args.no_flash:
+            flash(env)
+            time.sleep(args.boot_wait)
+        ble = read_ble(args.serial_port, args.baud)
+        rate, p50, worst = throughput(args.size, args.count)
+        rows[env] = {
+            "dram": fp["totals"]["dram"],
+            "nimble_dram": fp["subsystems"].get("nimble", {}).get("dram", 0),
+            "headroom": fp["totals"].get("dram_headroom", 0),
+            "rate": rate, "p50": p50, "max": worst, **ble,
+        }
+
+    print(f"\n{'env':10s} {'DRAM':>7s} {'nimble':>7s} {'headroom':>9s} {'stack heap':>10s} "
+          f"{'roles':>10s} {'mtu':>4s} {'B/s':>7s} {'p50 ms':>7s} {'max ms':>7s}")
+    for env, r in rows.items():
+        print(f"{env:10s} {r['dram']:7d} {r['nimble_dram']:7d} {r['headroom']:9d} "
+              f"{r.get('stack_heap', 0):10d} {r.get('roles', '?'):>10s} {r.get('mtu', 0):4d} "
+              f"{r['rate']:7.0f} {r['p50']:7.1f} {r['max']:7.1f}")
+    if len(rows) >= 2:
+        base, last = rows[envs[0]], rows[envs[-1]]
+        saved = (base["dram"] + base.get("stack_heap", 0)) - (last["dram"] + last.get("stack_heap", 0))
+        print(f"\n{envs[-1]} vs {envs[0]}: {saved} B less DRAM + BLE heap, "
+              f"throughput {100 * (last['rate'] / base['rate'] - 1) if base['rate'] else 0:+.1f}%")
+        if base["rate"] and last["rate"] < base["rate"] * (1 - args.tolerance / 100):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
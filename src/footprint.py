@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Per-feature flash/RAM footprint of every ENABLE_* build profile.
+
+Builds each PlatformIO env in PROFILES with a linker map, then attributes
+every input section to a subsystem by the object it came from:
+  IRAM   .iram0.*                      (instruction RAM, 128 KB shared with cache)
+  DRAM   .dram0.data/.bss, .noinit     (static RAM: every byte is gone from the heap)
+  FLASH  .flash.text/.rodata           (code and constants run from flash)
+plus the app image size and the DRAM left for the heap, which is where the
+HUB75 DMA buffers come from (see /panel).
+
+  python3 src/footprint.py                       table for every profile
+  python3 src/footprint.py --save fp.json        ...and keep it as a baseline
+  python3 src/footprint.py --baseline fp.json    flag growth against a saved run
+  python3 src/footprint.py --against HEAD~1      build that commit too and compare
+Exits 1 when anything grew by more than --tolerance bytes.
+"""
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PROFILES = ["usb_only", "esp32dev", "bt_lean", "wifi", "wifi_http", "wifi_bt", "wifi_bt_http"]
+
+KINDS = {
+    ".iram0.vectors": "iram", ".iram0.text": "iram", ".iram0.data": "iram", ".iram0.bss": "iram",
+    ".dram0.data": "dram", ".dram0.bss": "dram", ".noinit": "dram",
+    ".flash.text": "flash", ".flash.rodata": "flash", ".flash.appdesc": "flash",
+}
+
+# First match wins; matched against the object path in the map.
+SUBSYSTEMS = [
+    ("main", re.compile(r"src[/\\]main\.cpp\.o")),
+    ("nimble", re.compile(r"NimBLE", re.I)),
+    ("bt_ctrl", re.compile(r"lib(bt|btdm_app)\.a")),
+    ("http", re.compile(r"WebServer")),
+    ("wifi", re.compile(r"(WiFi|lib(esp_wifi|net80211|pp|wpa_supplicant|smartconfig|coexist|mesh)\.a)")),
+    ("lwip", re.compile(r"liblwip\.a")),
+    ("hub75", re.compile(r"HUB75|MatrixPanel", re.I)),
+    ("gfx", re.compile(r"Adafruit")),
+    ("arduino", re.compile(r"FrameworkArduino|cores[/\\]esp32")),
+    ("libc", re.compile(r"lib(c|m|gcc|stdc\+\+|newlib)\.a")),
+]
+
+INPUT_RE = re.compile(r"^\s+(\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+REGION_RE = re.compile(r"^(\w+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)")
+
+
+def subsystem(obj: str) -> str:
+    for name, rx in SUBSYSTEMS:
+        if rx.search(obj):
+            return name
+    return "idf"
+
+
+def parse_map(path: str):
+    """Return ({subsystem: {kind: bytes}}, {region: length})."""
+    usage, regions = {}, {}
+    out_kind = None
+    pending = None   # input section name printed alone on its line
+    stage = "head"
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("Memory Configuration"):
+                stage = "mem"
+                continue
+            if line.startswith("Linker script and memory map"):
+                stage = "map"
+                continue
+            if stage == "mem":
+                m = REGION_RE.match(line)
+                if m:
+                    regions[m.group(1)] = int(m.group(3), 16)
+                continue
+            if stage != "map":
+                continue
+            if line and not line[0].isspace():
+                # Output section header: ".flash.text   0x400d0020  0x12345"
+                out_kind = KINDS.get(line.split()[0])
+                pending = None
+                continue
+            if out_kind is None:
+                continue
+            stripped = line.strip()
+            if stripped.startswith(".") and len(stripped.split()) == 1:
+                pending = stripped
+                continue
+            m = INPUT_RE.match(line)
+            if not m or (m.group(1) is None and pending is None):
+                continue
+            name = m.group(1) or pending
+            pending = None
+            if name.startswith("*"):
+                continue   # *fill* and linker-script patterns
+            size = int(m.group(3), 16)
+            if size:
+                bucket = usage.setdefault(subsystem(m.group(4)), {})
+                bucket[out_kind] = bucket.get(out_kind, 0) + size
+    return usage, regions
+
+
+def build(root: str, env: str):
+    pio = shutil.which("pio") or shutil.which("platformio")
+    if not pio:
+        sys.exit("PlatformIO not found (pip install platformio)")
+    build_dir = os.path.join(root, ".pio", "build", env)
+    map_path = os.path.join(build_dir, "firmware.map")
+    flags = os.environ.get("PLATFORMIO_BUILD_FLAGS", "") + f" -Wl,-Map,{map_path}"
+    r = subprocess.run([pio, "run", "-d", root, "-e", env], env=dict(os.environ, PLATFORMIO_BUILD_FLAGS=flags),
+                       stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if r.returncode != 0:
+        print(r.stdout[-4000:])
+        sys.exit(f"build failed: {env}")
+    usage, regions = parse_map(map_path)
+    totals = {k: sum(u.get(k, 0) for u in usage.values()) for k in ("iram", "dram", "flash")}
+    totals["image"] = os.path.getsize(os.path.join(build_dir, "firmware.bin"))
+    if "dram0_0_seg" in regions:
+        totals["dram_headroom"] = regions["dram0_0_seg"] - totals["dram"]
+    return {"totals": totals, "subsystems": usage}
+
+
+def measure(root: str, envs):
+    return {env: build(root, env) for env in envs}
+
+
+def print_table(results):
+    for env, r in results.items():
+        t = r["totals"]
+        print(f"\n== {env}: image {t['image']} B, DRAM headroom for heap/DMA "
+              f"{t.get('dram_headroom', 'n/a')} B")
+        print(f"  {'subsystem':10s} {'IRAM':>8s} {'DRAM':>8s} {'FLASH':>9s}")
+        rows = sorted(r["subsystems"].items(), key=lambda kv: -sum(kv[1].values()))
+        for name, u in rows:
+            print(f"  {name:10s} {u.get('iram', 0):8d} {u.get('dram', 0):8d} {u.get('flash', 0):9d}")
+        print(f"  {'total':10s} {t['iram']:8d} {t['dram']:8d} {t['flash']:9d}")
+
+
+def compare(old, new, tolerance: int) -> bool:
+    grew = False
+    for env, r in new.items():
+        if env not in old:
+            continue
+        o = old[env]
+        checks = [("total", k, o["totals"].get(k, 0), v) for k, v in r["totals"].items() if k != "dram_headroom"]
+        for name, u in r["subsystems"].items():
+            ou = o["subsystems"].get(name, {})
+            checks += [(name, k, ou.get(k, 0), v) for k, v in u.items()]
+        for name, kind, before, after in checks:
+            if after - before > tolerance:
+                grew = True
+                print(f"GROWTH {env} {name}.{kind}: {before} -> {after} (+{after - before} B)")
+    if not grew:
+        print(f"\nno growth above {tolerance} B")
+    return grew
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--env", action="append", help="profile(s) to build (default: all)")
+    ap.add_argument("--save", help="write results as JSON")
+    ap.add_argument("--baseline", help="compare with a JSON file from --save")
+    ap.add_argument("--against", help="git revision to build and compare with")
+    ap.add_argument("--tolerance", type=int, default=64, help="bytes of growth to ignore")
+    args = ap.parse_args()
+    envs = args.env or PROFILES
+
+    results = measure(ROOT, envs)
+    print_table(results)
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=1, sort_keys=True)
+
+    old = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            old = json.load(f)
+    elif args.against:
+        tmp = tempfile.mkdtemp(prefix="footprint-")
+        wt = os.path.join(tmp, "tree")
+        subprocess.run(["git", "-C", ROOT, "worktree", "add", "--detach", wt, args.against], check=True)
+        try:
+            old = measure(wt, envs)
+        finally:
+            subprocess.run(["git", "-C", ROOT, "worktree", "remove", "--force", wt])
+            shutil.rmtree(tmp, ignore_errors=True)
+    if old is not None and compare(old, results, args.tolerance):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
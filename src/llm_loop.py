@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import os, time, re, sys, subprocess
 import asyncio
+import queue
 import threading
 from concurrent.futures import TimeoutError as FuturesTimeout
 from datetime import datetime
@@ -30,6 +31,13 @@ BLE_ADDRESS = os.getenv("BLE_ADDRESS")               # optional MAC/address to s
 BLE_ENABLED = (TRANSPORT == "BLE") or bool(BLE_NAME or BLE_ADDRESS)
 NUS_SERVICE_UUID = "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"
 NUS_RX_CHAR_UUID = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E"
+NUS_TX_CHAR_UUID = "6E400003-B5A3-F393-E0A9-E50E24DCCA9E"
+
+# Latency tracing: tag each message with "@<seq>" and wait for the firmware's
+# "[TRACE] seq=..." report (BLE notify / USB serial / GET /trace).
+TRACE        = os.getenv("TRACE", "1").strip().lower() not in ("0", "", "false", "no")
+TRACE_WAIT_S = float(os.getenv("TRACE_WAIT_S", "30"))
+TRACE_LINES: "queue.Queue[str]" = queue.Queue()
 
 try:
     from bleak import BleakClient, BleakScanner
@@ -235,6 +243,67 @@ def ollama_generate() -> str:
     except FileNotFoundError:
         raise RuntimeError("Ollama CLI not found. Install with: brew install ollama")
 
+TRACE_RE = re.compile(r"\[TRACE\] seq=(\d+) via=(\w+)(.*)")
+
+def parse_trace(line: str):
+    # "[TRACE] seq=7 via=ble dissolve=+812 thinking=+2501234 ... us" -> (7, {"dissolve": 812, ...})
+    m = TRACE_RE.search(line)
+    if not m:
+        return None, None
+    stages = {k: int(v) for k, v in re.findall(r"(\w+)=\+(\d+)", m.group(3))}
+    return int(m.group(1)), stages
+
+def wait_trace(seq: int, timeout: float):
+    deadline = time.monotonic() + timeout
+    while True:
+        left = deadline - time.monotonic()
+        if left <= 0:
+            return None
+        try:
+            line = TRACE_LINES.get(timeout=left)
+        except queue.Empty:
+            return None
+        got, stages = parse_trace(line)
+        if got == seq and "done" in stages:
+            return stages
+
+def pump_serial_trace(seq: int, timeout: float):
+    # USB: the report arrives on the same port; read it line by line.
+    deadline = time.monotonic() + timeout
+    while SER_HANDLE is not None and time.monotonic() < deadline:
+        line = SER_HANDLE.readline().decode("ascii", "ignore").strip()
+        if line.startswith("[TRACE]"):
+            TRACE_LINES.put(line)
+            got, _ = parse_trace(line)
+            if got == seq:
+                return
+
+def poll_http_trace(seq: int, timeout: float):
+    # HTTP: the server cannot push, so poll GET /trace next to the POST endpoint.
+    url = ESP32_URL.rsplit("/", 1)[0] + "/trace"
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        time.sleep(2)
+        try:
+            for line in requests.get(url, timeout=5).text.splitlines():
+                got, stages = parse_trace(line)
+                if got == seq and "done" in stages:
+                    TRACE_LINES.put(line)
+                    return
+        except Exception:
+            pass
+
+def print_breakdown(seq: int, transport: str, transfer_ms: float, stages):
+    # Firmware stages are microseconds since receipt; show each step's own duration.
+    parts = [f"{transport.lower()}_transfer={transfer_ms:.1f}ms"]
+    prev = 0
+    for name in ("dissolve", "thinking", "first_glyph", "done"):
+        if name in stages:
+            parts.append(f"{name}=+{(stages[name] - prev) / 1000:.1f}ms")
+            prev = stages[name]
+    total = transfer_ms + prev / 1000
+    print(f"TRACE seq={seq} " + " ".join(parts) + f" | end-to-end={total:.1f}ms", flush=True)
+
 def send_http(payload: str):
     if not ESP32_URL:
         raise RuntimeError("ESP32_URL not set")
@@ -291,6 +360,21 @@ class BlePersistent:
         self.target = address
         self.client: BleakClient | None = None
         self.ev = _BleLoop()
+        self.last_write_ms = 0.0
+        self._rx_buf = ""
+
+    def _on_notify(self, _sender, data: bytearray):
+        # Firmware splits each line over several notifications; reassemble on '\n'.
+        self._rx_buf += bytes(data).decode("ascii", "ignore")
+        while "\n" in self._rx_buf:
+            line, self._rx_buf = self._rx_buf.split("\n", 1)
+            if line.startswith("[TRACE]"):
+                TRACE_LINES.put(line)
+            elif line.startswith("[RX] NAK"):
+                print(line, file=sys.stderr, flush=True)
+            elif line.startswith("[BLE]"):
+                # Link statistics (firmware built with BLE_STATS_NOTIFY_S, or a /ble reply)
+                print(line, flush=True)
 
     async def _discover_target(self) -> str:
         # If we have a cached target, keep using it. The OS may change IDs, so verify by scan if connect fails.
@@ -357,16 +441,24 @@ class BlePersistent:
         if not c.is_connected:
             raise RuntimeError("BLE connect failed")
         self.client = c
+        if TRACE:
+            try:
+                await c.start_notify(NUS_TX_CHAR_UUID, self._on_notify)
+            except Exception as e:
+                print("BLE notify subscribe failed (no traces):", e, flush=True)
 
     async def _write(self, payload: str):
         await self._ensure_connected()
         data = payload.encode("ascii", "ignore")
+        t0 = time.perf_counter()
         try:
             await self.client.write_gatt_char(NUS_RX_CHAR_UUID, data, response=True)
         except Exception:
             # attempt one reconnect then retry once
             await self._ensure_connected()
+            t0 = time.perf_counter()
             await self.client.write_gatt_char(NUS_RX_CHAR_UUID, data, response=True)
+        self.last_write_ms = (time.perf_counter() - t0) * 1000
 
     def connect(self):
         self.ev.call(self._ensure_connected())
@@ -427,7 +519,9 @@ def main():
         except Exception as e:
             print("Initial BLE connect failed:", e, flush=True)
 
+    seq = 0
     while True:
+        waited = 0.0
         try:
             raw = ollama_generate()
             # Enforce whole-word, ≤MAX_TOKENS, ≤MAX_LINES, then wrap to display width
@@ -439,6 +533,11 @@ def main():
             payload = formatted if formatted.endswith("\n") else formatted + "\n"
             print("Generated (wrapped to", width, "cols):\n" + payload, flush=True)
 
+            seq += 1
+            if TRACE:
+                payload = f"@{seq}\n" + payload  # firmware strips this line
+
+            t0 = time.perf_counter()
             if transport == "HTTP":
                 resp = send_http(payload)
                 print("HTTP ->", resp, flush=True)
@@ -448,10 +547,27 @@ def main():
             else:  # USB
                 resp = send_serial(payload)
                 print("SERIAL ->", resp, flush=True)
+            transfer_ms = (time.perf_counter() - t0) * 1000
+            if transport == "BLE" and _BLE_PERSIST is not None:
+                transfer_ms = _BLE_PERSIST.last_write_ms  # GATT write only, not reconnects
+
+            if TRACE:
+                w0 = time.monotonic()
+                wait_s = min(TRACE_WAIT_S, INTERVAL_S)
+                if transport == "USB":
+                    pump_serial_trace(seq, wait_s)
+                elif transport == "HTTP":
+                    poll_http_trace(seq, wait_s)
+                stages = wait_trace(seq, max(0.1, wait_s - (time.monotonic() - w0)))
+                if stages:
+                    print_breakdown(seq, transport, transfer_ms, stages)
+                else:
+                    print(f"TRACE seq={seq}: no report within {wait_s:.0f}s", flush=True)
+                waited = time.monotonic() - w0
         except Exception as e:
             print("Error:", e, flush=True)
         
-        time.sleep(INTERVAL_S)
+        time.sleep(max(0.0, INTERVAL_S - waited))
 
     # On exit, try to close BLE cleanly (normally unreachable)
     if _BLE_PERSIST is not None:
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""Flood the panel's ingest paths and report what made it to the screen.
+
+Every message is tagged "@<seq>" (see llm_loop.py) so the firmware's
+"[TRACE] seq=..." reports can be matched back to it:
+  accepted    picked up by loop() (a trace was reported)
+  completed   typed out in full
+  superseded  replaced by a newer message mid-animation
+  dropped     sent fine but overwritten before loop() picked it up, or
+              rejected by the firmware as too long (see --size)
+  errors      the transport itself failed (HTTP status, BLE/serial write)
+Before and after each run the firmware's receive counters are read from
+`/trace` (GET /trace for HTTP) to cross-check the drop count.
+
+Over USB the firmware ends a message after USB_QUIET_MS (20 ms) of UART
+silence, so every USB write is followed by --usb-gap seconds of quiet;
+without it a burst would arrive as one merged frame. That gap caps a
+single USB sender at roughly 1/usb-gap messages per second.
+
+Examples:
+  SERIAL_PORT=/dev/cu.usbserial-0001 python3 load_gen.py --transport usb --rate 2 --duration 60
+  ESP32_URL=http://172.20.10.5/post python3 load_gen.py --transport http --rates 0.5,1,2,5,10
+  python3 load_gen.py --transport ble,usb --rate 1 --burst 5 --size 40:200
+"""
+import argparse
+import random
+import re
+import sys
+import threading
+import time
+
+import requests
+
+import llm_loop
+from llm_loop import parse_trace
+
+try:
+    import serial
+except Exception:
+    serial = None
+
+END_RE = re.compile(r"\[TRACE\] end rx_usb=(\d+) rx_ble=(\d+) rx_http=(\d+) overwritten=(\d+)"
+                    r"(?: rejected_usb=(\d+) rejected_ble=(\d+) rejected_http=(\d+) usb_stalls=(\d+))?")
+END_KEYS = ("usb", "ble", "http", "overwritten", "rej_usb", "rej_ble", "rej_http", "usb_stalls")
+WORDS = "the panel says hello world again while philosophers drink cold tea and argue".split()
+
+
+def make_text(size: int, cols: int) -> str:
+    # Words wrapped to the panel width, padded/cut to roughly `size` bytes.
+    out, line = [], ""
+    while sum(len(l) + 1 for l in out) + len(line) < size:
+        w = random.choice(WORDS)
+        if line and len(line) + 1 + len(w) > cols:
+            out.append(line)
+            line = w
+        else:
+            line = f"{line} {w}" if line else w
+    out.append(line)
+    return "\n".join(out)[:max(1, size)].rstrip() + "\n"
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        self.sent = {}        # seq -> (transport, transfer_ms)
+        self.errors = 0
+        self.traces = {}      # seq -> stages dict (+ "superseded")
+        self.untagged = 0     # traces with seq=0: a message split in transit
+        self.counters = {}    # last "[TRACE] end" counters seen
+
+    def on_line(self, line: str):
+        m = END_RE.search(line)
+        if m:
+            with self.lock:
+                self.counters = {k: int(v) for k, v in zip(END_KEYS, m.groups()) if v is not None}
+            return
+        seq, stages = parse_trace(line)
+        if seq is None:
+            return
+        with self.lock:
+            if seq == 0:
+                self.untagged += 1
+            elif seq in self.sent and len(stages) >= len(self.traces.get(seq, {})):
+                # The /trace ring can show a message still in flight; keep the fullest report.
+                stages["superseded"] = "superseded" in line
+                self.traces[seq] = stages
+
+
+class UsbLink:
+    def __init__(self, res: Results, port: str, baud: int, gap: float):
+        if serial is None:
+            raise RuntimeError("pyserial not installed")
+        self.res = res
+        self.gap = gap
+        self.lock = threading.Lock()
+        self.last_write_ms = 0.0
+        self.ser = serial.Serial(port, baud, timeout=0.5)
+        try:
+            self.ser.dtr = False  # avoid auto-reset on USB-UART bridges
+            self.ser.rts = False
+        except Exception:
+            pass
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        while True:
+            line = self.ser.readline().decode("ascii", "ignore").strip()
+            if line:
+                self.res.on_line(line)
+
+    def send(self, payload: str):
+        # Keep the line quiet afterwards so the firmware closes this frame on its own
+        with self.lock:
+            t0 = time.perf_counter()
+            self.ser.write(payload.encode("ascii", "ignore"))
+            self.ser.flush()
+            self.last_write_ms = (time.perf_counter() - t0) * 1000
+            time.sleep(self.gap)
+
+    def query(self):
+        self.send("/trace\n")
+
+
+class HttpLink:
+    def __init__(self, res: Results, url: str):
+        self.res = res
+        self.url = url
+        self.trace_url = url.rsplit("/", 1)[0] + "/trace"
+        threading.Thread(target=self._poller, daemon=True).start()
+
+    def _poller(self):
+        # The server cannot push; the trace ring holds 8, so poll often.
+        while True:
+            time.sleep(0.5)
+            self.query()
+
+    def send(self, payload: str):
+        r = requests.post(self.url, data=payload.encode("ascii", "ignore"),
+                          headers={"Content-Type": "text/plain"}, timeout=10)
+        r.raise_for_status()
+
+    def query(self):
+        try:
+            for line in requests.get(self.trace_url, timeout=5).text.splitlines():
+                self.res.on_line(line)
+        except Exception:
+            pass
+
+
+class BleLink:
+    def __init__(self, res: Results):
+        self.res = res
+        llm_loop.send_ble("")  # connect and subscribe to TX notifications
+        threading.Thread(target=self._drain, daemon=True).start()
+
+    def _drain(self):
+        while True:
+            self.res.on_line(llm_loop.TRACE_LINES.get())
+
+    def send(self, payload: str):
+        llm_loop.send_ble(payload)
+
+    def query(self):
+        # /trace replies over TX; only [TRACE] lines reach TRACE_LINES, which is all we need.
+        llm_loop.send_ble("/trace\n")
+
+
+class Sequencer:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.n = int(time.time()) % 100000 * 1000  # distinct from earlier runs' ids
+
+    def next(self) -> int:
+        with self.lock:
+            self.n += 1
+            return self.n
+
+
+def producer(name, link, res, seqs, args, rate, stop_at):
+    # Bursts of `burst` back-to-back messages, spaced so the mean rate is `rate`.
+    period = args.burst / rate
+    next_at = time.monotonic()
+    while time.monotonic() < stop_at:
+        for _ in range(args.burst):
+            size = random.randint(args.size_min, args.size_max)
+            seq = seqs.next()
+            payload = f"@{seq}\n" + make_text(size, args.cols)
+            with res.lock:
+                res.sent[seq] = (name, 0.0)  # before sending: the trace may beat send() back
+            t0 = time.perf_counter()
+            try:
+                link.send(payload)
+            except Exception as e:
+                with res.lock:
+                    del res.sent[seq]
+                    res.errors += 1
+                print(f"{name}: send failed: {e}", file=sys.stderr, flush=True)
+                continue
+            ms = (time.perf_counter() - t0) * 1000
+            if name == "ble" and llm_loop._BLE_PERSIST is not None:
+                ms = llm_loop._BLE_PERSIST.last_write_ms  # GATT write only
+            elif name == "usb":
+                ms = link.last_write_ms  # without the quiet gap
+            with res.lock:
+                res.sent[seq] = (name, ms)
+        next_at += period
+        time.sleep(max(0.0, next_at - time.monotonic()))
+
+
+def pct(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+
+def fmt_dist(values):
+    return " ".join(f"p{p}={pct(values, p):.0f}" for p in (50, 90, 99)) + f" max={max(values) if values else float('nan'):.0f}"
+
+
+def run_once(links, res, seqs, args, rate):
+    with res.lock:
+        res.reset()
+    first = next(iter(links))[1]
+    first.query()
+    time.sleep(1.0)
+    before = dict(res.counters)
+
+    stop_at = time.monotonic() + args.duration
+    threads = [threading.Thread(target=producer, args=(n, l, res, seqs, args, rate, stop_at), daemon=True)
+               for n, l in links]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    time.sleep(args.drain)  # let the last message finish on the panel
+    first.query()
+    time.sleep(1.0)
+    after = dict(res.counters)
+    return res, before, after
+
+
+def report(res, before, after, rate, args):
+    with res.lock:
+        sent = dict(res.sent)
+        traces = dict(res.traces)
+    print(f"\n=== rate {rate:g} msg/s per transport, burst {args.burst}, "
+          f"size {args.size_min}-{args.size_max} B, {args.duration:g} s ===")
+    for name in sorted({v[0] for v in sent.values()}):
+        mine = [s for s, v in sent.items() if v[0] == name]
+        seen = [traces[s] for s in mine if s in traces]
+        done = [t for t in seen if "done" in t and not t["superseded"]]
+        sup = sum(1 for t in seen if t["superseded"])
+        print(f"{name:5s} sent={len(mine)} accepted={len(seen)} completed={len(done)} "
+              f"superseded={sup} dropped={len(mine) - len(seen)}")
+        print(f"      transfer_ms  {fmt_dist([sent[s][1] for s in mine])}")
+        print(f"      pickup_ms    {fmt_dist([t['dissolve'] / 1000 for t in seen if 'dissolve' in t])}")
+        print(f"      glyph_ms     {fmt_dist([t['first_glyph'] / 1000 for t in seen if 'first_glyph' in t])}")
+        print(f"      done_ms      {fmt_dist([t['done'] / 1000 for t in done])}")
+    print(f"errors={res.errors} untagged_traces={res.untagged} (non-zero means messages were split in transit)")
+    if before and after:
+        d = {k: after[k] - before.get(k, 0) for k in after}
+        print(f"firmware: rx usb={d['usb']} ble={d['ble']} http={d['http']} overwritten={d['overwritten']}")
+        if "rej_usb" in d:
+            print(f"firmware: rejected usb={d['rej_usb']} ble={d['rej_ble']} http={d['rej_http']} "
+                  f"usb_stalls={d['usb_stalls']} (frames over the firmware's TEXT_CAP or no buffer free)")
+    else:
+        print("firmware: counters unavailable (no '[TRACE] end' reply)")
+
+
+def parse_args():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--transport", default="usb", help="comma-separated: usb,http,ble")
+    ap.add_argument("--rate", type=float, default=1.0, help="messages per second, per transport")
+    ap.add_argument("--rates", help="comma-separated rates to sweep (overrides --rate)")
+    ap.add_argument("--burst", type=int, default=1, help="messages sent back-to-back per burst")
+    ap.add_argument("--size", default="60", help="payload bytes, N or MIN:MAX")
+    ap.add_argument("--duration", type=float, default=30.0, help="seconds per rate")
+    ap.add_argument("--drain", type=float, default=15.0, help="seconds to wait after the last send")
+    ap.add_argument("--cols", type=int, default=llm_loop.PANEL_COLS)
+    ap.add_argument("--serial-port", default=llm_loop.SERIAL_PORT)
+    ap.add_argument("--baud", type=int, default=llm_loop.BAUD)
+    ap.add_argument("--usb-gap", type=float, default=0.05,
+                    help="seconds of silence after each USB write (> the firmware's USB_QUIET_MS)")
+    ap.add_argument("--url", default=llm_loop.ESP32_URL, help="HTTP POST endpoint")
+    args = ap.parse_args()
+    lo, _, hi = args.size.partition(":")
+    args.size_min, args.size_max = int(lo), int(hi or lo)
+    return args
+
+
+def main():
+    args = parse_args()
+    res = Results()
+    links = []
+    for name in [t.strip().lower() for t in args.transport.split(",") if t.strip()]:
+        if name == "usb":
+            if not args.serial_port:
+                sys.exit("Set SERIAL_PORT or --serial-port for usb")
+            links.append((name, UsbLink(res, args.serial_port, args.baud, args.usb_gap)))
+            time.sleep(0.2)
+        elif name == "http":
+            if not args.url:
+                sys.exit("Set ESP32_URL or --url for http")
+            links.append((name, HttpLink(res, args.url)))
+        elif name == "ble":
+            if llm_loop.BleakClient is None:
+                sys.exit("bleak not installed. Install with: pip install bleak")
+            links.append((name, BleLink(res)))
+        else:
+            sys.exit(f"unknown transport {name!r}")
+
+    seqs = Sequencer()
+    rates = [float(r) for r in args.rates.split(",")] if args.rates else [args.rate]
+    for rate in rates:
+        report(*run_once(links, res, seqs, args, rate), rate, args)
+
+
+if __name__ == "__main__":
+    main()
@@ -2,11 +2,17 @@
 #include <ESP32-HUB75-MatrixPanel-I2S-DMA.h>
 #include <Adafruit_GFX.h>
 #include <string>
+#include <new>
+#include <utility>
 
 
 
 #include <WiFi.h>
 #include <WebServer.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <StreamString.h>
 
 // (BLE headers included later inside the ENABLE_BT block after flags are set)
 
@@ -26,6 +32,18 @@
 #define PANEL_RES_Y 64   // height of ONE panel
 #define PANEL_CHAIN 2    // two 64x64 panels chained horizontally -> 128x64 total
 
+// Colour-depth profile. The driver sizes its DMA bitplanes from
+// PIXEL_COLOR_DEPTH_BITS, which has to reach the library's own sources, so
+// the depth is set in platformio.ini ([env:text]) rather than here.
+#define PANEL_PROFILE_IMAGE 0   // driver default depth (8 bitplanes)
+#define PANEL_PROFILE_TEXT  1   // few bitplanes: ample for the six-step gradient, less DMA, faster refresh
+#ifndef PANEL_PROFILE
+#define PANEL_PROFILE PANEL_PROFILE_IMAGE
+#endif
+#if PANEL_PROFILE == PANEL_PROFILE_TEXT && (!defined(PIXEL_COLOR_DEPTH_BITS) || PIXEL_COLOR_DEPTH_BITS >= 8)
+#error "PANEL_PROFILE_TEXT needs a reduced -DPIXEL_COLOR_DEPTH_BITS in build_flags"
+#endif
+
 // Allow board-specific HUB75 pin remapping without editing logic below.
 #ifndef HUB75_R1_PIN
 #define HUB75_R1_PIN 25
@@ -79,6 +97,376 @@
 // Display
 MatrixPanel_I2S_DMA *dma_display = nullptr;
 
+// Render target. Drawing code goes through `gfx`, which is the panel in normal
+// operation and a NullGfx sink while the state machine runs on simulated time.
+static Adafruit_GFX *gfx = nullptr;
+
+// Same packing as MatrixPanel_I2S_DMA::color565, usable without a panel.
+static inline uint16_t color565(uint8_t r, uint8_t g, uint8_t b) {
+  return (uint16_t)(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+}
+
+// Discards everything drawn to it; glyph rasterization is skipped too.
+class NullGfx : public Adafruit_GFX {
+ public:
+  NullGfx() : Adafruit_GFX(PANEL_RES_X * PANEL_CHAIN, PANEL_RES_Y) {}
+  void drawPixel(int16_t, int16_t, uint16_t) override {}
+  void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) override {}
+  void fillScreen(uint16_t) override {}
+  size_t write(uint8_t) override { return 1; }
+};
+
+// Counts the in-bounds pixels written to it (Adafruit_GFX funnels text and
+// rectangles through drawPixel when nothing faster is overridden).
+class CountingGfx : public Adafruit_GFX {
+ public:
+  uint32_t pixels = 0;
+  CountingGfx() : Adafruit_GFX(PANEL_RES_X * PANEL_CHAIN, PANEL_RES_Y) {}
+  void drawPixel(int16_t x, int16_t y, uint16_t) override {
+    if (x >= 0 && y >= 0 && x < width() && y < height()) pixels++;
+  }
+};
+
+// ===== Allocation hooks =====
+// With ALLOC_HOOKS=1 (and the matching -Wl,--wrap flags in platformio.ini)
+// every malloc/calloc/realloc is counted per CPU core. The loop task runs on
+// core 1 while the BLE/Wi-Fi stacks mostly live on core 0, so the core-1
+// counter is what our own code allocates. Each core also carries a current
+// subsystem tag (set by AllocScope) so counts can be attributed.
+#ifndef ALLOC_HOOKS
+#define ALLOC_HOOKS 0
+#endif
+
+// STATIC_ALLOC=1: the dissolve's shuffle buffer and the panel object get static
+// storage sized from PANEL_RES_X/Y and PANEL_CHAIN, and the hooks below
+// treat any allocation on the loop task's core after setup() as a violation.
+// Commands (diagnostics allocate on purpose), log lines such as reports and
+// NAKs (Print::printf allocates for lines over 64 chars), WebServer, and
+// LittleFS/NVS writes, whose internals allocate, are exempt by their
+// AllocScope tag. Violations are counted with the caller's address for /heap;
+// STATIC_ALLOC_PANIC=1 aborts instead, so the backtrace names the caller.
+#ifndef STATIC_ALLOC
+#define STATIC_ALLOC 0
+#endif
+#ifndef STATIC_ALLOC_PANIC
+#define STATIC_ALLOC_PANIC 0
+#endif
+#if STATIC_ALLOC && !ALLOC_HOOKS
+#error "STATIC_ALLOC needs ALLOC_HOOKS=1 and the -Wl,--wrap flags"
+#endif
+
+enum AllocTag : uint8_t { ALLOC_OTHER, ALLOC_USB, ALLOC_BLE, ALLOC_HTTP, ALLOC_RENDER,
+                          ALLOC_DISSOLVE, ALLOC_CMD, ALLOC_STORE, ALLOC_LOG, ALLOC_TAG_COUNT };
+static const char* const kAllocTagNames[ALLOC_TAG_COUNT] = {
+  "other", "usb", "ble", "http", "render", "dissolve", "cmd", "store", "log"
+};
+
+static volatile uint32_t gAllocCalls[2] = {0, 0};
+static volatile uint32_t gAllocByTag[ALLOC_TAG_COUNT] = {0};
+static volatile uint8_t  gAllocTag[2] = {ALLOC_OTHER, ALLOC_OTHER};
+
+static inline void IRAM_ATTR countAlloc() {
+  const int core = xPortGetCoreID();
+  gAllocCalls[core]++;
+  gAllocByTag[gAllocTag[core]]++;
+}
+
+// Attributes allocations made on this core within the scope to a subsystem.
+struct AllocScope {
+  uint8_t core;
+  uint8_t prev;
+  explicit AllocScope(AllocTag t) : core((uint8_t)xPortGetCoreID()), prev(gAllocTag[core]) { gAllocTag[core] = t; }
+  ~AllocScope() { gAllocTag[core] = prev; }
+};
+
+static inline uint32_t allocCallsThisCore() { return gAllocCalls[xPortGetCoreID()]; }
+
+struct HeapTrap {
+  volatile bool     armed;
+  volatile uint8_t  core;       // the loop task's core
+  volatile uint32_t violations;
+  volatile uint32_t lastPc;     // return address of the last offending malloc/calloc/realloc
+  volatile uint32_t lastSize;
+  volatile uint8_t  lastTag;
+};
+static HeapTrap gHeapTrap = {};
+
+static inline void IRAM_ATTR checkAlloc(size_t size, void* pc) {
+  #if STATIC_ALLOC
+  if (!gHeapTrap.armed || xPortGetCoreID() != gHeapTrap.core) return;
+  const uint8_t tag = gAllocTag[gHeapTrap.core];
+  if (tag == ALLOC_CMD || tag == ALLOC_LOG || tag == ALLOC_HTTP || tag == ALLOC_STORE) return;
+  gHeapTrap.violations++;
+  gHeapTrap.lastPc = (uint32_t)(uintptr_t)pc;
+  gHeapTrap.lastSize = (uint32_t)size;
+  gHeapTrap.lastTag = tag;
+  #if STATIC_ALLOC_PANIC
+  abort();
+  #endif
+  #endif
+}
+
+#if ALLOC_HOOKS
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* IRAM_ATTR __wrap_malloc(size_t size) {
+  countAlloc();
+  checkAlloc(size, __builtin_return_address(0));
+  return __real_malloc(size);
+}
+void* IRAM_ATTR __wrap_calloc(size_t n, size_t size) {
+  countAlloc();
+  checkAlloc(n * size, __builtin_return_address(0));
+  return __real_calloc(n, size);
+}
+void* IRAM_ATTR __wrap_realloc(void* ptr, size_t size) {
+  countAlloc();
+  checkAlloc(size, __builtin_return_address(0));
+  return __real_realloc(ptr, size);
+}
+}
+#endif
+
+// ===== Heap telemetry =====
+// Free heap, largest free block and their ratio (fragmentation) are sampled
+// on every state transition and once per HEAP_SAMPLE_MS. Each period's
+// low-water marks go into a ring, so a largest-block figure trending down
+// toward what the dissolve's malloc needs shows up long before it fails.
+#ifndef HEAP_SAMPLE_MS
+#define HEAP_SAMPLE_MS 60000UL
+#endif
+#ifndef HEAP_WARN_LARGEST
+#define HEAP_WARN_LARGEST 16384   // warn when the largest 8-bit block drops below this
+#endif
+
+struct HeapPeriod {
+  uint32_t endMs;        // millis() when the period closed
+  uint32_t minFree;      // low-water free bytes seen in the period
+  uint32_t minLargest;   // low-water largest free block seen in the period
+};
+
+struct HeapTelemetry {
+  static const uint8_t kRing = 16;
+  uint32_t periodStartMs = 0;
+  uint32_t curMinFree    = UINT32_MAX;
+  uint32_t curMinLargest = UINT32_MAX;
+  uint32_t samples       = 0;
+  HeapPeriod ring[kRing] = {};
+  uint8_t  head  = 0;
+  uint8_t  count = 0;
+};
+static HeapTelemetry gHeap;
+
+static void heapSample() {
+  uint32_t freeB   = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  gHeap.samples++;
+  if (freeB < gHeap.curMinFree) gHeap.curMinFree = freeB;
+  if (largest < gHeap.curMinLargest) gHeap.curMinLargest = largest;
+}
+
+static void printHeapNow(Print& out) {
+  uint32_t freeB   = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  out.printf("[HEAP] free=%lu largest=%lu frag=%lu%% min_ever=%lu dma_free=%lu dma_largest=%lu\n",
+             (unsigned long)freeB, (unsigned long)largest,
+             (unsigned long)(freeB ? 100UL - (uint64_t)largest * 100UL / freeB : 0),
+             (unsigned long)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             (unsigned long)heap_caps_get_free_size(MALLOC_CAP_DMA),
+             (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
+}
+
+static void printHeapTrap(Print& out) {
+  #if STATIC_ALLOC
+  out.printf("[HEAP] static mode: %lu allocations after setup", (unsigned long)gHeapTrap.violations);
+  if (gHeapTrap.violations) {
+    out.printf(", last %lu B from pc=0x%08lx (%s)", (unsigned long)gHeapTrap.lastSize,
+               (unsigned long)gHeapTrap.lastPc, kAllocTagNames[gHeapTrap.lastTag]);
+  }
+  out.println();
+  #endif
+}
+
+// Close the period once HEAP_SAMPLE_MS has passed: log it and push its low-water marks.
+static void heapTick() {
+  uint32_t now = millis();
+  if (now - gHeap.periodStartMs < HEAP_SAMPLE_MS) return;
+  AllocScope tag(ALLOC_LOG);
+  heapSample();
+  HeapPeriod& p = gHeap.ring[gHeap.head];
+  p.endMs = now;
+  p.minFree = gHeap.curMinFree;
+  p.minLargest = gHeap.curMinLargest;
+  gHeap.head = (uint8_t)((gHeap.head + 1) % HeapTelemetry::kRing);
+  if (gHeap.count < HeapTelemetry::kRing) gHeap.count++;
+  gHeap.periodStartMs = now;
+  gHeap.curMinFree = gHeap.curMinLargest = UINT32_MAX;
+
+  printHeapNow(Serial);
+  #if STATIC_ALLOC
+  static uint32_t reported = 0;
+  if (gHeapTrap.violations != reported) {
+    reported = gHeapTrap.violations;
+    printHeapTrap(Serial);
+  }
+  #endif
+  if (p.minLargest < HEAP_WARN_LARGEST) {
+    Serial.printf("[HEAP] WARNING largest free block fell to %lu bytes this period\n",
+                  (unsigned long)p.minLargest);
+  }
+}
+
+// `/heap`: current figures, allocation counts per subsystem, then the history.
+static void printHeapReport(Print& out) {
+  printHeapNow(out);
+  printHeapTrap(out);
+  #if ALLOC_HOOKS
+  out.print("[HEAP] allocs");
+  for (uint8_t i = 0; i < ALLOC_TAG_COUNT; ++i) {
+    out.printf(" %s=%lu", kAllocTagNames[i], (unsigned long)gAllocByTag[i]);
+  }
+  out.printf(" (core0=%lu core1=%lu)\n", (unsigned long)gAllocCalls[0], (unsigned long)gAllocCalls[1]);
+  #else
+  out.println("[HEAP] allocs: build with ALLOC_HOOKS=1 to count");
+  #endif
+  for (uint8_t i = 0; i < gHeap.count; ++i) {
+    const HeapPeriod& p = gHeap.ring[(gHeap.head + HeapTelemetry::kRing - gHeap.count + i) % HeapTelemetry::kRing];
+    out.printf("[HEAP]   t=%lus min_free=%lu min_largest=%lu\n", (unsigned long)(p.endMs / 1000UL),
+               (unsigned long)p.minFree, (unsigned long)p.minLargest);
+  }
+  out.println("[HEAP] end");
+}
+
+// ===== Text buffers =====
+// Messages travel in fixed-capacity TextBufs from a static pool, so nothing
+// on the message path allocates once setup() is done. A TextRef owns one
+// buffer and can only be moved; dropping it returns the buffer to the pool.
+// Ingest fills its own buffer and hands it over with textPublish(); loop()
+// collects it with textTakePending() and frees the one it replaces.
+#ifndef TEXT_CAP
+#define TEXT_CAP 512   // bytes per message, including the terminator
+#endif
+#ifndef TEXT_BUFS
+#define TEXT_BUFS 8    // shown + pending + one filling per transport + BLE command + /sim spares
+#endif
+
+struct TextBuf {
+  uint16_t len;
+  char     s[TEXT_CAP];
+  TextBuf* next;       // free list link
+};
+static TextBuf  gTextPool[TEXT_BUFS];
+static TextBuf* gTextFree = nullptr;
+static TextBuf* gTextPending = nullptr;   // published, not yet picked up by loop()
+static uint32_t gTextPoolEmpty = 0;       // textAlloc() calls that found no buffer
+static portMUX_TYPE gTextMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void textFree(TextBuf* b) {
+  if (!b) return;
+  portENTER_CRITICAL(&gTextMux);
+  b->next = gTextFree;
+  gTextFree = b;
+  portEXIT_CRITICAL(&gTextMux);
+}
+
+class TextRef {
+ public:
+  TextRef() : b_(nullptr) {}
+  explicit TextRef(TextBuf* b) : b_(b) {}
+  TextRef(TextRef&& o) : b_(o.b_) { o.b_ = nullptr; }
+  TextRef& operator=(TextRef&& o) {
+    if (this != &o) { reset(); b_ = o.b_; o.b_ = nullptr; }
+    return *this;
+  }
+  TextRef(const TextRef&) = delete;
+  TextRef& operator=(const TextRef&) = delete;
+  ~TextRef() { reset(); }
+
+  explicit operator bool() const { return b_ != nullptr; }
+  const char* c_str() const { return b_ ? b_->s : ""; }
+  size_t length() const { return b_ ? b_->len : 0; }
+  bool full() const { return b_ && b_->len >= TEXT_CAP - 1; }
+  bool hasNewline() const { return b_ && memchr(b_->s, '\n', b_->len); }
+  void clear() { if (b_) { b_->len = 0; b_->s[0] = 0; } }
+  void reset() { textFree(b_); b_ = nullptr; }
+  TextBuf* release() { TextBuf* b = b_; b_ = nullptr; return b; }
+
+  // Appends up to the capacity; returns false if anything was cut off.
+  bool append(const char* p, size_t n) {
+    if (!b_) return false;
+    size_t room = TEXT_CAP - 1 - b_->len;
+    bool fits = n <= room;
+    if (!fits) n = room;
+    memcpy(b_->s + b_->len, p, n);
+    b_->len = (uint16_t)(b_->len + n);
+    b_->s[b_->len] = 0;
+    return fits;
+  }
+  bool append(char c) { return append(&c, 1); }
+
+  void eraseFront(size_t n) {
+    if (!b_) return;
+    if (n > b_->len) n = b_->len;
+    memmove(b_->s, b_->s + n, b_->len - n + 1);
+    b_->len = (uint16_t)(b_->len - n);
+  }
+
+ private:
+  TextBuf* b_;
+};
+
+static void textPoolInit() {
+  for (uint8_t i = 0; i < TEXT_BUFS; ++i) textFree(&gTextPool[i]);
+}
+
+// An empty buffer, or an empty ref when the pool is exhausted.
+static TextRef textAlloc() {
+  portENTER_CRITICAL(&gTextMux);
+  TextBuf* b = gTextFree;
+  if (b) gTextFree = b->next;
+  else gTextPoolEmpty++;
+  portEXIT_CRITICAL(&gTextMux);
+  if (b) { b->len = 0; b->s[0] = 0; }
+  return TextRef(b);
+}
+
+static TextRef textCopy(const char* s) {
+  TextRef t = textAlloc();
+  t.append(s, strlen(s));
+  return t;
+}
+
+// Ingest side: hand a finished message to loop(). One still pending is
+// replaced (it was never shown) and goes back to the pool.
+static void textPublish(TextRef&& t) {
+  TextBuf* b = t.release();
+  portENTER_CRITICAL(&gTextMux);
+  TextBuf* old = gTextPending;
+  gTextPending = b;
+  portEXIT_CRITICAL(&gTextMux);
+  textFree(old);
+}
+
+static TextRef textTakePending() {
+  portENTER_CRITICAL(&gTextMux);
+  TextBuf* b = gTextPending;
+  gTextPending = nullptr;
+  portEXIT_CRITICAL(&gTextMux);
+  return TextRef(b);
+}
+
+static void printTextPool(Print& out) {
+  uint8_t nfree = 0;
+  portENTER_CRITICAL(&gTextMux);
+  for (TextBuf* b = gTextFree; b; b = b->next) nfree++;
+  portEXIT_CRITICAL(&gTextMux);
+  out.printf("[HEAP] text bufs %u/%u free (%u B each), pool empty %lu times\n",
+             (unsigned)nfree, (unsigned)TEXT_BUFS, (unsigned)TEXT_CAP, (unsigned long)gTextPoolEmpty);
+}
+
 // ===== Bluetooth (BLE) =====
 #if ENABLE_BT
 #include <NimBLEDevice.h>
@@ -87,10 +475,187 @@ static const char* NUS_SERVICE_UUID      = "6E400001-B5A3-F393-E0A9-E50E24DCCA9E
 static const char* NUS_CHAR_UUID_RX      = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E"; // write from central -> ESP32
 static const char* NUS_CHAR_UUID_TX      = "6E400003-B5A3-F393-E0A9-E50E24DCCA9E"; // notify from ESP32 -> central
 
+// ATT MTU we ask centrals for; 185 fits a full macOS write in one packet.
+#ifndef BLE_MTU
+#define BLE_MTU 185
+#endif
+// The host has to be able to hold that MTU, or writes get split and
+// throughput drops (see [nimble_lean] in platformio.ini).
+#if CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU < BLE_MTU
+#error "CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU is below BLE_MTU"
+#endif
+#if CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE < BLE_MTU + 8   // + L2CAP and ATT write headers
+#error "CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE cannot hold a BLE_MTU packet"
+#endif
+
 static NimBLEServer*          gBleServer         = nullptr;
 static NimBLECharacteristic*  gBleTxChar         = nullptr;
 static NimBLEAdvertising*     gBleAdvertising    = nullptr;
-static std::string            bleAccum; // accumulate until newline
+
+// A '/' command written over BLE is handed to loop() (outside the NimBLE task)
+static TextRef                bleCommand;
+static volatile bool          bleCommandPending  = false;
+static volatile bool          bleNakPending      = false; // a frame was rejected; loop() sends the NAK
+static portMUX_TYPE           bleCommandMux      = portMUX_INITIALIZER_UNLOCKED;
+
+// Print adapter that sends command output as NUS TX notifications, one
+// notification per line (split to fit the default ATT payload).
+class BleTxPrint : public Print {
+ public:
+  size_t write(uint8_t b) override {
+    buf_[len_++] = b;
+    if (b == '\n' || len_ == sizeof(buf_)) flush();
+    return 1;
+  }
+  void flush() override {
+    if (!len_) return;
+    if (gBleTxChar) {
+      gBleTxChar->setValue(buf_, len_);
+      gBleTxChar->notify();
+      delay(2); // let the host stack drain before queueing the next notification
+    }
+    len_ = 0;
+  }
+ private:
+  uint8_t buf_[20];
+  size_t  len_ = 0;
+};
+
+// ===== BLE link statistics =====
+// Negotiated link parameters, receive throughput, message fragmentation and
+// recent disconnects, so a late message can be blamed on the link or not.
+// Written from the NimBLE host task, read from the loop task; every field is
+// word-sized, so a report can be one write stale but never torn.
+// With BLE_STATS_NOTIFY_S > 0 the report is also notified on TX that often
+// while connected (only between animations; notifying blocks the loop).
+#ifndef BLE_STATS_NOTIFY_S
+#define BLE_STATS_NOTIFY_S 0
+#endif
+
+struct BleDisconnect {
+  uint32_t ms;       // millis() when it happened
+  int      reason;   // NimBLE code: BLE_HS_ERR_HCI_BASE (0x200) + HCI reason
+};
+
+struct BleLinkStats {
+  static const uint8_t kDiscRing = 8;
+  uint32_t connects;
+  uint32_t connectedMs;      // millis() at connect, 0 while disconnected
+  uint16_t mtu;
+  uint16_t intervalUnits;    // 1.25 ms units
+  uint16_t latency;          // connection events the peripheral may skip
+  uint16_t timeoutUnits;     // 10 ms units
+  uint8_t  txPhy, rxPhy;     // 1 = 1M, 2 = 2M, 3 = coded
+  // Receive side, for the current (or last) connection
+  uint32_t bytes, writes;
+  uint32_t msgs, fragMsgs, maxFrags;   // complete messages / those spanning >1 write
+  uint32_t fragsCur;                   // writes into the message being assembled
+  uint32_t secStartMs, secBytes, secWrites;
+  uint32_t peakBytesPerS, peakWritesPerS;
+  BleDisconnect disc[kDiscRing];
+  uint8_t  discHead, discCount;
+};
+static BleLinkStats gBleStats = {};
+static uint32_t gBleStackHeap = 0;   // heap the NimBLE host and our GATT setup took in initBLE()
+static volatile bool gBleReady = false; // initBLE() has returned; setup() waits for it
+
+static void bleStatsParams(const NimBLEConnInfo& ci) {
+  gBleStats.mtu           = ci.getMTU();
+  gBleStats.intervalUnits = ci.getConnInterval();
+  gBleStats.latency       = ci.getConnLatency();
+  gBleStats.timeoutUnits  = ci.getConnTimeout();
+}
+
+static void bleStatsWrite(size_t n) {
+  BleLinkStats& s = gBleStats;
+  uint32_t now = millis();
+  if (now - s.secStartMs >= 1000UL) {
+    s.secStartMs = now;
+    s.secBytes = s.secWrites = 0;
+  }
+  s.bytes += n;
+  s.writes++;
+  s.fragsCur++;
+  s.secBytes += n;
+  s.secWrites++;
+  if (s.secBytes > s.peakBytesPerS) s.peakBytesPerS = s.secBytes;
+  if (s.secWrites > s.peakWritesPerS) s.peakWritesPerS = s.secWrites;
+}
+
+static void bleStatsMessage() {
+  BleLinkStats& s = gBleStats;
+  s.msgs++;
+  if (s.fragsCur > 1) s.fragMsgs++;
+  if (s.fragsCur > s.maxFrags) s.maxFrags = s.fragsCur;
+  s.fragsCur = 0;
+}
+
+static const char* blePhyName(uint8_t phy) {
+  switch (phy) {
+    case 1: return "1M";
+    case 2: return "2M";
+    case 3: return "coded";
+    default: return "?";
+  }
+}
+
+// Which NimBLE build this is and what it cost; compare across [env:bt_lean]
+// and esp32dev. Static DRAM is in src/footprint.py's "nimble" row;
+// src/ble_compare.py puts both next to a BLE write-throughput run.
+static void printBleStack(Print& out) {
+  #if defined(CONFIG_BT_NIMBLE_ROLE_CENTRAL) || defined(CONFIG_BT_NIMBLE_ROLE_OBSERVER)
+  const char* roles = "all";
+  #else
+  const char* roles = "peripheral";
+  #endif
+  out.printf("[BLE] stack heap=%lu B roles=%s max_conn=%u bonds=%u cccds=%u msys=%ux%u pref_mtu=%u mtu=%u\n",
+             (unsigned long)gBleStackHeap, roles, (unsigned)CONFIG_BT_NIMBLE_MAX_CONNECTIONS,
+             (unsigned)CONFIG_BT_NIMBLE_MAX_BONDS, (unsigned)CONFIG_BT_NIMBLE_MAX_CCCDS,
+             (unsigned)CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT, (unsigned)CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE,
+             (unsigned)CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU, (unsigned)BLE_MTU);
+}
+
+static void printBleStats(Print& out) {
+  const BleLinkStats& s = gBleStats;
+  uint32_t now = millis();
+  printBleStack(out);
+  uint32_t upS = s.connectedMs ? (now - s.connectedMs) / 1000UL : 0;
+  if (s.connectedMs) {
+    out.printf("[BLE] connected %lus (connects=%lu) mtu=%u interval=%lu.%02lu ms latency=%u timeout=%lu ms phy=%s/%s\n",
+               (unsigned long)upS, (unsigned long)s.connects, s.mtu,
+               (unsigned long)(s.intervalUnits * 125UL / 100UL), (unsigned long)(s.intervalUnits * 125UL % 100UL),
+               s.latency, (unsigned long)s.timeoutUnits * 10UL, blePhyName(s.txPhy), blePhyName(s.rxPhy));
+  } else {
+    out.printf("[BLE] not connected (connects=%lu); figures below are from the last connection\n",
+               (unsigned long)s.connects);
+  }
+  out.printf("[BLE] rx bytes=%lu writes=%lu avg=%lu B/s peak=%lu B/s %lu writes/s\n",
+             (unsigned long)s.bytes, (unsigned long)s.writes,
+             (unsigned long)(upS ? s.bytes / upS : 0),
+             (unsigned long)s.peakBytesPerS, (unsigned long)s.peakWritesPerS);
+  out.printf("[BLE] messages=%lu fragmented=%lu max_writes_per_msg=%lu pending_writes=%lu\n",
+             (unsigned long)s.msgs, (unsigned long)s.fragMsgs, (unsigned long)s.maxFrags,
+             (unsigned long)s.fragsCur);
+  for (uint8_t i = 0; i < s.discCount; ++i) {
+    const BleDisconnect& d = s.disc[(s.discHead + BleLinkStats::kDiscRing - s.discCount + i) % BleLinkStats::kDiscRing];
+    out.printf("[BLE]   disconnect %lus ago reason=%d (hci 0x%02x)\n", (unsigned long)((now - d.ms) / 1000UL),
+               d.reason, (unsigned)(d.reason & 0xFF));
+  }
+}
+
+// Periodic report over TX; `quiet` is true when nothing is animating.
+static void bleStatsTick(bool quiet) {
+  #if BLE_STATS_NOTIFY_S > 0
+  static uint32_t lastMs = 0;
+  uint32_t now = millis();
+  if (!quiet || !gBleStats.connectedMs || now - lastMs < BLE_STATS_NOTIFY_S * 1000UL) return;
+  lastMs = now;
+  AllocScope tag(ALLOC_LOG);
+  BleTxPrint out;
+  printBleStats(out);
+  out.flush();
+  #endif
+}
 
 class RxCallbacks : public NimBLECharacteristicCallbacks {
   void onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*connInfo*/) override;
@@ -98,10 +663,37 @@ class RxCallbacks : public NimBLECharacteristicCallbacks {
 static RxCallbacks gRxCallbacks;
 
 class ServerCallbacks : public NimBLEServerCallbacks {
-  void onConnect(NimBLEServer* /*srv*/, NimBLEConnInfo& /*ci*/) override {
-    if (Serial) Serial.println("[BLE] central connected");
+  void onConnect(NimBLEServer* srv, NimBLEConnInfo& ci) override {
+    BleLinkStats& s = gBleStats;
+    s.bytes = s.writes = s.msgs = s.fragMsgs = s.maxFrags = s.fragsCur = 0;
+    s.secBytes = s.secWrites = s.peakBytesPerS = s.peakWritesPerS = 0;
+    s.txPhy = s.rxPhy = 1;
+    srv->getPhy(ci.getConnHandle(), &s.txPhy, &s.rxPhy);
+    bleStatsParams(ci);
+    s.connects++;
+    s.connectedMs = millis() | 1UL; // never 0 while connected
+    if (Serial) {
+      Serial.printf("[BLE] central connected mtu=%u interval=%lu us\n", s.mtu,
+                    (unsigned long)s.intervalUnits * 1250UL);
+    }
+  }
+  void onMTUChange(uint16_t mtu, NimBLEConnInfo& /*ci*/) override {
+    gBleStats.mtu = mtu;
+  }
+  void onConnParamsUpdate(NimBLEConnInfo& ci) override {
+    bleStatsParams(ci);
+  }
+  void onPhyUpdate(NimBLEConnInfo& /*ci*/, uint8_t txPhy, uint8_t rxPhy) override {
+    gBleStats.txPhy = txPhy;
+    gBleStats.rxPhy = rxPhy;
   }
   void onDisconnect(NimBLEServer* /*srv*/, NimBLEConnInfo& /*ci*/, int reason) override {
+    BleLinkStats& s = gBleStats;
+    s.disc[s.discHead].ms = millis();
+    s.disc[s.discHead].reason = reason;
+    s.discHead = (uint8_t)((s.discHead + 1) % BleLinkStats::kDiscRing);
+    if (s.discCount < BleLinkStats::kDiscRing) s.discCount++;
+    s.connectedMs = 0;
     if (Serial) { Serial.print("[BLE] central disconnected, reason="); Serial.println(reason); }
     if (gBleAdvertising) {
       gBleAdvertising->start(); // resume advertising so scanners can see it again
@@ -112,11 +704,12 @@ class ServerCallbacks : public NimBLEServerCallbacks {
 static ServerCallbacks gServerCallbacks;
 
 static void initBLE() {
+  const uint32_t heapBefore = ESP.getFreeHeap();
   // Init BLE stack
   NimBLEDevice::init("MatrixPanel");
   if (Serial) Serial.println("[BLE] init: name=MatrixPanel");
   NimBLEDevice::setPower(ESP_PWR_LVL_P7); // max tx power for stability
-  NimBLEDevice::setMTU(185);              // allow larger writes from macOS
+  NimBLEDevice::setMTU(BLE_MTU);          // allow larger writes from macOS
 
   gBleServer = NimBLEDevice::createServer();
   gBleServer->setCallbacks(&gServerCallbacks);
@@ -147,10 +740,12 @@ static void initBLE() {
   gBleAdvertising->setName("MatrixPanel");
   NimBLEDevice::setDeviceName("MatrixPanel");
   gBleAdvertising->start();
-  if (Serial) Serial.println("[BLE] advertising started (NUS)");
+  const uint32_t heapAfter = ESP.getFreeHeap();
+  gBleStackHeap = heapBefore > heapAfter ? heapBefore - heapAfter : 0;
+  if (Serial) Serial.printf("[BLE] advertising started (NUS), stack heap=%lu B\n", (unsigned long)gBleStackHeap);
 }
 #endif
-static bool kNewLivePending = false; // trigger to start dissolve->thinking->typewriter on new text
+static volatile bool kNewLivePending = false; // trigger to start dissolve->thinking->typewriter on new text
 
 // ===== Wi-Fi (STA) + HTTP server =====
 const char* WIFI_SSID = "TodayYouAreYou-ThatIsTruerThanTrue";
@@ -158,289 +753,1862 @@ const char* WIFI_PASS = "bunnyBunny1!";
 WebServer server(80);
 
 // ===== Wrapped text mode (Option A) =====
-static String gLiveText;         // incoming free-form text (no fixed line count)
+static TextRef gLiveText;        // incoming free-form text (no fixed line count); display-owned
 static bool   gHasLiveText = false;
 
-#if ENABLE_BT
-// Define the onWrite now that globals above are declared
-void RxCallbacks::onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*connInfo*/) {
-  std::string v = c->getValue();
-  if (v.empty()) return;
-  // Append incoming bytes and look for a newline to mark a complete message
-  bleAccum.append(v);
-  if (bleAccum.find('\n') != std::string::npos) {
-    gLiveText = String(bleAccum.c_str());
-    gHasLiveText = true;
-    kNewLivePending = true;
-    bleAccum.clear();
-  }
-}
+// ===== Event timeline =====
+// A ring of 8-byte begin/end/instant events from every task (loop sections,
+// render calls, frames, idle waits, BLE writes, message receipt, state
+// changes), cheap enough to leave on: one micros(), one atomic increment, a
+// thread-local read of the task's slot and a store per event. `/timeline` dumps the ring as hex "[TL]" lines and
+// src/timeline_to_perfetto.py turns a captured dump into Chrome trace JSON
+// (chrome://tracing or ui.perfetto.dev).
+#ifndef TIMELINE
+#define TIMELINE 1
 #endif
+#ifndef TIMELINE_EVENTS
+#define TIMELINE_EVENTS 1024   // power of two
+#endif
+static_assert((TIMELINE_EVENTS & (TIMELINE_EVENTS - 1)) == 0, "TIMELINE_EVENTS must be a power of two");
+
+enum TlPhase : uint8_t { TL_BEGIN, TL_END, TL_INSTANT };
+// The first seven follow LoopSection, the next four ProfSection.
+enum TlName : uint8_t {
+  TL_HTTP, TL_USB, TL_BLE, TL_WIFI, TL_SCREEN, TL_STORE, TL_BLE_CB,
+  TL_GRADIENT, TL_SPAN, TL_THINKING, TL_DISSOLVE,
+  TL_LOOP, TL_IDLE, TL_FRAME, TL_RX, TL_STATE, TL_COUNT
+};
+static const char* const kTlNames[TL_COUNT] = {
+  "http", "usb", "ble", "wifi", "screen", "store", "ble_cb",
+  "drawWrappedGradient", "drawGradientSpan", "renderThining", "dissolveClearBlocks",
+  "loop", "idle", "frame", "rx", "state"
+};
 
-// Combined canned sentences (built from existing 6-line sets)
-static String gCannedText[16];   // supports up to 16 canned sets; actual count built in setup
-static int    gCannedCount = 0;
-
-// ===== Text geometry =====
-// Two chained 64x64 panels = 128px wide. Using 5x7 font + 1px spacing ≈ 6 px/char -> ~21 cols
-static const uint8_t kCols = 21;        // used for cursor advance only (wrap is automatic)
-
-// ===== Trite philosophies (each line exactly 10 chars) =====
-static const char* kPhilosophies[][6] = {
-  { // Set 1
-    "Life is   ",
-    "mostly fog",
-    "and echoes",
-    "of old tea",
-    "cooling so",
-    "again hmm."
-  },
-  { // Set 2
-    "Truth: meh",
-    "we nod now",
-    "meaning is",
-    "soft so so",
-    "for a bit.",
-    "then naps."
-  },
-  { // Set 3
-    "Time hums.",
-    "like a fan",
-    "in a small",
-    "we call it",
-    "and stays.",
-    "same as me"
-  },
-  { // Set 4
-    "Hope shows",
-    "then hides",
-    "we shrug a",
-    "little bit",
-    "and sip we",
-    "again sure"
-  },
-  { // Set 5
-    "Meaning is",
-    "just a map",
-    "of places ",
-    "we drew on",
-    "in the fog",
-    "last night"
-  },
-  { // Set 6
-    "Mind drift",
-    "over pools",
-    "of bright ",
-    "dot we map",
-    "then we nap",
-    "by morning"
-  }
-};
-static const int kNumPhilos = sizeof(kPhilosophies) / sizeof(kPhilosophies[0]);
-static int currentPhilo = 0; // index into kPhilosophies
+struct TlEvent {
+  uint32_t us;
+  uint8_t  name;        // TlName
+  uint8_t  phaseTask;   // TlPhase << 6 | task index
+  uint16_t arg;         // instants: message seq (low 16 bits) or ScreenState
+};
 
-// Target brightness for normal view
-// Increase for daylight readability (0..255). Was 60.
-static const uint8_t kTargetBrightness = 120;
+struct Timeline {
+  static const uint8_t kMaxTasks = 8;
+  volatile bool on = true;
+  uint32_t head = 0;    // events ever written; the ring holds the last TIMELINE_EVENTS
+  TaskHandle_t tasks[kMaxTasks] = {};
+  char taskNames[kMaxTasks][16] = {};
+  volatile uint8_t nTasks = 0;
+  TlEvent ev[TIMELINE ? TIMELINE_EVENTS : 1];   // TIMELINE=0 keeps the commands but not the RAM
+};
+static Timeline gTl;
+static portMUX_TYPE gTlMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Small per-task index; a task registers itself on its first event and keeps
+// the slot in task-local storage, so later events skip the table scan.
+static __thread uint8_t tTlSlot = 0;   // slot + 1, 0 = not registered yet
+
+static uint8_t tlTaskSlow() {
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+  for (uint8_t i = 0; i < gTl.nTasks; ++i) if (gTl.tasks[i] == me) return i;
+  uint8_t i = Timeline::kMaxTasks - 1;   // overflow shares the last slot
+  portENTER_CRITICAL(&gTlMux);
+  if (gTl.nTasks < Timeline::kMaxTasks) {
+    i = gTl.nTasks;
+    gTl.tasks[i] = me;
+    strncpy(gTl.taskNames[i], pcTaskGetName(me), sizeof(gTl.taskNames[i]) - 1);
+    gTl.nTasks = (uint8_t)(i + 1);
+  }
+  portEXIT_CRITICAL(&gTlMux);
+  return i;
+}
 
-// ===== Dynamic per-line color palette =====
-static uint16_t gLineColors[6] = {0};
+static inline uint8_t tlTask() {
+  if (!tTlSlot) tTlSlot = (uint8_t)(tlTaskSlow() + 1);
+  return (uint8_t)(tTlSlot - 1);
+}
 
-static inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t t /*0..255*/) {
-  return (uint8_t)(((uint16_t)a * (255 - t) + (uint16_t)b * t + 127) / 255);
+static inline void tlEvent(TlName name, TlPhase ph, uint16_t arg = 0) {
+  #if TIMELINE
+  if (!gTl.on) return;
+  const uint32_t i = __atomic_fetch_add(&gTl.head, 1, __ATOMIC_RELAXED);
+  TlEvent& e = gTl.ev[i & (TIMELINE_EVENTS - 1)];
+  e.us = micros();
+  e.name = name;
+  e.phaseTask = (uint8_t)(ph << 6 | tlTask());
+  e.arg = arg;
+  #endif
 }
 
-// Build a palette where line 0 is white and line 5 is the solid base color.
-static void makePaletteFromBase(uint8_t br, uint8_t bg, uint8_t bb) {
-  for (int i = 0; i < 6; ++i) {
-    // t from 0 (top/white) to 255 (bottom/base)
-    uint8_t t = (uint8_t)(i * (255 / 5));
-    uint8_t r = lerp8(255, br, t);
-    uint8_t g = lerp8(255, bg, t);
-    uint8_t b = lerp8(255, bb, t);
-    gLineColors[i] = dma_display->color565(r, g, b);
+struct TlScope {
+  TlName name;
+  explicit TlScope(TlName n) : name(n) { tlEvent(name, TL_BEGIN); }
+  ~TlScope() { tlEvent(name, TL_END); }
+};
+
+// Four events per line, each as us(8) name(2) phase|task(2) arg(4) hex digits.
+static void dumpTimeline(Print& out) {
+  gTl.on = false;
+  delay(2); // let a writer on the other core finish its slot
+  const uint32_t head = gTl.head;
+  const uint32_t n = head < TIMELINE_EVENTS ? head : TIMELINE_EVENTS;
+  out.printf("[TL] begin events=%lu overwritten=%lu now=%lu\n", (unsigned long)n,
+             (unsigned long)(head - n), (unsigned long)micros());
+  out.print("[TL] names");
+  for (uint8_t i = 0; i < TL_COUNT; ++i) out.printf(" %s", kTlNames[i]);
+  out.print("\n[TL] tasks");
+  for (uint8_t i = 0; i < gTl.nTasks; ++i) out.printf(" %u:%s", i, gTl.taskNames[i]);
+  out.println();
+  for (uint32_t k = 0; k < n; ++k) {
+    const TlEvent& e = gTl.ev[(head - n + k) & (TIMELINE_EVENTS - 1)];
+    if (k % 4 == 0) out.print("[TL] ");
+    out.printf("%08lx%02x%02x%04x", (unsigned long)e.us, e.name, e.phaseTask, e.arg);
+    if (k % 4 == 3 || k + 1 == n) out.println();
   }
+  out.println("[TL] end");
+  gTl.on = true;
 }
 
-// Pick a saturated random base color and build the palette.
-static void randomizePalette() {
-  // Ensure it's not too close to white/grey: pick one channel high, others random.
-  uint8_t which = (uint8_t)random(3); // 0=r,1=g,2=b
-  uint8_t r = (which == 0) ? 255 : (uint8_t)random(40, 221);
-  uint8_t g = (which == 1) ? 255 : (uint8_t)random(40, 221);
-  uint8_t b = (which == 2) ? 255 : (uint8_t)random(40, 221);
-  makePaletteFromBase(r, g, b);
-}
+// ===== Loop monitor =====
+// Timestamps every loop() iteration and the named sections inside it. An
+// iteration whose busy time (idle waits and frame-pacing sleeps excluded)
+// reaches STALL_THRESHOLD_MS is logged as a stall together with the section
+// that took longest, and kept in a small ring for the `/stalls` command. BLE
+// callbacks run on the NimBLE host task, so they are tracked as their own
+// pseudo-section.
+#ifndef STALL_THRESHOLD_MS
+#define STALL_THRESHOLD_MS 100
+#endif
 
-// ===== Utilities =====
-// Render multi-line text with a white->base gradient per visual line.
-// If revealChars >= 0, only the first `revealChars` characters across all lines are drawn (typewriter).
-static void drawWrappedGradient(const String& text, int32_t revealChars /* -1 = full */) {
-  dma_display->fillScreen(0);
-  dma_display->setTextWrap(false); // we manage wrapping upstream (Python) to avoid word splits
+enum LoopSection : uint8_t { SEC_HTTP, SEC_USB, SEC_BLE, SEC_WIFI, SEC_SCREEN, SEC_STORE, SEC_BLE_CB,
+                             SEC_COUNT };
+static_assert((int)SEC_BLE_CB == (int)TL_BLE_CB, "LoopSection and TlName must line up");
+static const char* const kSectionNames[SEC_COUNT] = { "http", "usb", "ble", "wifi", "screen", "store", "ble_cb" };
 
-  int y = 0;                 // line baseline, 10px per row with 5x7 font
-  int lineIdx = 0;           // visual line index for gradient color
-  int shown = 0;             // total characters drawn so far
+static volatile uint32_t gIdleUsTotal = 0;  // idle-wait time since boot (not busy time)
 
-  int start = 0;
-  const int n = text.length();
-  while (start < n) {
-    int end = text.indexOf('\n', start);
-    if (end < 0) end = n;
-    String line = text.substring(start, end);
+struct StallRecord {
+  uint32_t atMs;       // millis() when the iteration ended
+  uint32_t loopUs;     // busy time of the whole iteration
+  uint32_t sectionUs;  // busy time of the worst section
+  uint8_t  section;    // LoopSection that overran
+  uint8_t  state;      // ScreenState the iteration started in
+};
 
-    // Determine how many chars of this line to draw under the reveal limit
-    int toShow = line.length();
-    if (revealChars >= 0) {
-      int remaining = revealChars - shown;
-      if (remaining <= 0) break;
-      if (toShow > remaining) toShow = remaining;
-    }
+struct LoopMonitor {
+  static const uint8_t kRing = 8;
+  uint32_t iterStartUs   = 0;
+  uint32_t idleAtStartUs = 0;
+  uint32_t sectionUs[SEC_COUNT] = {0};  // current iteration
+  uint32_t worstUs[SEC_COUNT]   = {0};  // worst single run since reset
+  uint32_t iterations = 0;
+  uint32_t stalls     = 0;
+  uint32_t cbStalls   = 0;              // BLE callbacks over the threshold
+  uint32_t maxLoopUs  = 0;
+  StallRecord ring[kRing] = {};
+  uint8_t  ringHead  = 0;
+  uint8_t  ringCount = 0;
+
+  void begin() {
+    tlEvent(TL_LOOP, TL_BEGIN);
+    iterStartUs = micros();
+    idleAtStartUs = gIdleUsTotal;
+  }
 
-    // Color for this visual line (clamp past 5 to the base color)
-    uint16_t col = gLineColors[(lineIdx < 6) ? lineIdx : 5];
-    dma_display->setCursor(0, y);
-    dma_display->setTextColor(col);
-    for (int i = 0; i < toShow; ++i) {
-      dma_display->print(line[i]);
-    }
+  void add(LoopSection s, uint32_t us) {
+    sectionUs[s] += us;
+    if (us > worstUs[s]) worstUs[s] = us;
+  }
 
-    shown += toShow;
-    if (revealChars >= 0 && shown >= revealChars) break;
+  // From other tasks: only the worst case and a count, no per-iteration state.
+  void noteCallback(LoopSection s, uint32_t us) {
+    if (us > worstUs[s]) worstUs[s] = us;
+    if (us >= STALL_THRESHOLD_MS * 1000UL) cbStalls++;
+  }
 
-    y += 10;     // advance one text row (approx 8px tall font + spacing)
-    lineIdx++;
-    start = end + 1; // skip the newline we consumed
+  // Close the iteration. Returns the new ring entry if it stalled, else nullptr.
+  const StallRecord* end(uint8_t state) {
+    tlEvent(TL_LOOP, TL_END);
+    uint32_t busy = (micros() - iterStartUs) - (gIdleUsTotal - idleAtStartUs);
+    iterations++;
+    if (busy > maxLoopUs) maxLoopUs = busy;
+    const StallRecord* rec = nullptr;
+    if (busy >= STALL_THRESHOLD_MS * 1000UL) {
+      uint8_t worst = 0;
+      for (uint8_t i = 1; i < SEC_COUNT; ++i) if (sectionUs[i] > sectionUs[worst]) worst = i;
+      StallRecord& r = ring[ringHead];
+      r.atMs = millis();
+      r.loopUs = busy;
+      r.sectionUs = sectionUs[worst];
+      r.section = worst;
+      r.state = state;
+      ringHead = (uint8_t)((ringHead + 1) % kRing);
+      if (ringCount < kRing) ringCount++;
+      stalls++;
+      rec = &r;
+    }
+    memset(sectionUs, 0, sizeof(sectionUs));
+    return rec;
   }
-}
 
-// Random-pixel dissolve that clears the screen over duration_ms
-void dissolveClear(uint16_t w, uint16_t h, uint32_t duration_ms) {
-  const uint32_t N = (uint32_t)w * (uint32_t)h;         // 4096 for 64×64
-  uint16_t *idx = (uint16_t*)malloc(N * sizeof(uint16_t));
-  if (!idx) return;
-  for (uint32_t i = 0; i < N; ++i) idx[i] = (uint16_t)i;
-  for (uint32_t i = N - 1; i > 0; --i) {
-    uint32_t j = (uint32_t)random(i + 1);
-    uint16_t t = idx[i]; idx[i] = idx[j]; idx[j] = t;
+  void reset() { *this = LoopMonitor(); }
+};
+static LoopMonitor gLoopMon;
+
+// Charges the enclosing scope's busy time (minus idle waits) to a section.
+struct SectionTimer {
+  LoopSection sec;
+  uint32_t t0;
+  uint32_t idle0;
+  explicit SectionTimer(LoopSection s) : sec(s), t0(micros()), idle0(gIdleUsTotal) {
+    tlEvent((TlName)sec, TL_BEGIN);
+  }
+  ~SectionTimer() {
+    gLoopMon.add(sec, (micros() - t0) - (gIdleUsTotal - idle0));
+    tlEvent((TlName)sec, TL_END);
+  }
+};
+
+// ===== Message traces =====
+// End-to-end latency of each live message. A host may prefix a message with
+// an "@<seq>" line; the firmware strips it and stamps receipt, dissolve start,
+// thinking start, first glyph and completion against that id. The last
+// kTraceRing traces are kept for `/trace` (and GET /trace); each completed
+// trace (or one cut short by a newer message) is also reported on the
+// transport it arrived on. Per-transport receive counts and the number of
+// messages overwritten before loop() picked them up back the load
+// generator's accepted/dropped figures (src/load_gen.py).
+enum Transport : uint8_t { VIA_USB, VIA_BLE, VIA_HTTP };
+static const char* const kViaNames[] = { "usb", "ble", "http" };
+
+enum TraceStage : uint8_t { TR_RX, TR_DISSOLVE, TR_THINKING, TR_FIRST_GLYPH, TR_DONE, TR_COUNT };
+static const char* const kTraceStageNames[TR_COUNT] = { "rx", "dissolve", "thinking", "first_glyph", "done" };
+
+struct MsgTrace {
+  uint32_t seq;               // host sequence id, 0 when untagged
+  uint8_t  via;               // Transport
+  bool     superseded;        // replaced by a newer message before it finished
+  uint32_t atUs[TR_COUNT];    // micros() per stage, 0 = not reached
+};
+
+static const uint8_t kTraceRing = 8;
+static MsgTrace gTraces[kTraceRing];
+static uint8_t  gTraceHead  = 0;
+static uint8_t  gTraceCount = 0;
+static MsgTrace* gActiveTrace = nullptr;   // message currently on its way to the panel
+
+// Receipt details of the pending message, written by whichever transport accepted it
+static volatile uint32_t gRxSeq = 0;
+static volatile uint8_t  gRxVia = VIA_USB;
+static volatile uint32_t gRxUs  = 0;
+
+static volatile uint32_t gRxCount[3]    = {};  // per Transport
+static volatile uint32_t gRxOverwritten = 0;   // replaced while still pending: never shown
+static volatile uint32_t gRxRejected[3] = {};  // frames refused: longer than TEXT_CAP or no buffer free
+static volatile uint32_t gRxUsbStalls   = 0;   // times USB reading paused for want of a buffer
+
+// ===== Ingest framing =====
+// USB and BLE are byte streams and a message spans several lines, so a text
+// frame ends when the sender pauses: the end of a BLE write, or USB_QUIET_MS
+// without a byte on the UART (rxEnd). It must contain a '\n' by then. A
+// command ("/...") is a single line and ends at its '\n'; whatever follows in
+// the same chunk starts the next frame. A frame that would not fit in one
+// TextBuf (or finds the pool empty) is rejected whole: the rest of it is
+// skipped up to the pause and the sender is told with an "[RX] NAK" line on
+// the same transport. USB instead stops reading while no buffer is free,
+// leaving bytes in the UART driver. Either way a hostile sender cannot make
+// the firmware hold more than TEXT_CAP.
+#ifndef USB_QUIET_MS
+#define USB_QUIET_MS 20   // UART gap that ends a USB text frame
+#endif
+
+enum RxStatus : uint8_t { RX_MORE, RX_FRAME, RX_REJECTED };
+
+static uint32_t gUsbRxMs = 0;          // millis() of the last USB chunk
+static bool     gUsbPending = false;   // bytes read since the last quiet gap
+
+struct RxFramer {
+  TextRef buf;
+  bool    skipping = false;   // inside a rejected frame, waiting for the pause
+};
+
+// Take bytes from p/n. Returns early with RX_FRAME, p/n just past the line,
+// when a command completes; the caller feeds the rest after handling it.
+static RxStatus rxFeed(RxFramer& f, const char*& p, size_t& n) {
+  if (f.skipping) { p += n; n = 0; return RX_MORE; }
+  if (!f.buf) f.buf = textAlloc();
+  const bool cmd = f.buf.length() ? f.buf.c_str()[0] == '/' : (n && p[0] == '/');
+  size_t take = n;
+  if (cmd) {
+    const char* nl = (const char*)memchr(p, '\n', n);
+    if (nl) take = (size_t)(nl + 1 - p);
   }
-  uint32_t us_per_px = (duration_ms * 1000UL) / (N ? N : 1);
-  if (us_per_px == 0) us_per_px = 1;
-  for (uint32_t k = 0; k < N; ++k) {
-    uint16_t p = idx[k];
-    int16_t x = p % w;
-    int16_t y = p / w;
-    dma_display->drawPixel(x, y, 0);
-    delayMicroseconds(us_per_px);
+  if (!f.buf.append(p, take)) {
+    f.buf.clear();
+    f.skipping = true;
+    p += n; n = 0;
+    return RX_REJECTED;
   }
-  free(idx);
+  p += take; n -= take;
+  return (cmd && f.buf.hasNewline()) ? RX_FRAME : RX_MORE;
 }
 
-// Clear screen in random blocks for a very visible dissolve.
-// block = tile size (e.g., 4 px), duration_ms is total animation time.
-void dissolveClearBlocks(uint16_t w, uint16_t h, uint32_t duration_ms, uint8_t block = 4) {
-  const uint16_t nx = (w + block - 1) / block;
-  const uint16_t ny = (h + block - 1) / block;
-  const uint32_t N  = (uint32_t)nx * (uint32_t)ny;
+// The sender paused: a text frame holding a '\n' is complete.
+static RxStatus rxEnd(RxFramer& f) {
+  f.skipping = false;
+  return (f.buf && f.buf.hasNewline()) ? RX_FRAME : RX_MORE;
+}
+
+static void printNak(Transport via, Print& out) {
+  AllocScope tag(ALLOC_LOG);   // longer than Print::printf's stack buffer
+  out.printf("[RX] NAK %s frame rejected (over %u bytes or no buffer) rejected=%lu\n", kViaNames[via],
+             (unsigned)(TEXT_CAP - 1), (unsigned long)gRxRejected[via]);
+}
+
+// Strip a leading "@<seq>" line from `text`; returns the id or 0 if absent.
+// Only an all-digit line counts, so a message starting "@alice" is left alone.
+static uint32_t takeSeqHeader(TextRef& text) {
+  const char* s = text.c_str();
+  if (text.length() < 2 || s[0] != '@' || !isdigit((unsigned char)s[1])) return 0;
+  const char* nl = strchr(s, '\n');
+  if (!nl) return 0;
+  char* end = nullptr;
+  uint32_t seq = (uint32_t)strtoul(s + 1, &end, 10);
+  if (end != nl) return 0;
+  text.eraseFront((size_t)(nl - s) + 1);
+  return seq;
+}
 
-  uint16_t *idx = (uint16_t*)malloc(N * sizeof(uint16_t));
-  if (!idx) return;
+// Called by a transport with a complete message, just before textPublish().
+static void noteReceipt(Transport via, TextRef& text) {
+  gRxCount[via]++;
+  if (kNewLivePending) gRxOverwritten++;
+  gRxUs  = micros();
+  gRxVia = via;
+  gRxSeq = takeSeqHeader(text);
+  tlEvent(TL_RX, TL_INSTANT, (uint16_t)gRxSeq);
+}
 
-  for (uint32_t i = 0; i < N; ++i) idx[i] = (uint16_t)i;
+static void reportTrace(const MsgTrace& t);
 
-  // Fisher–Yates shuffle
-  for (uint32_t i = N - 1; i > 0; --i) {
-    uint32_t j = (uint32_t)random(i + 1);
-    uint16_t t = idx[i]; idx[i] = idx[j]; idx[j] = t;
+// Loop side: open a trace for the message that was just picked up.
+static void traceBegin() {
+  if (gActiveTrace) {
+    gActiveTrace->superseded = true;
+    reportTrace(*gActiveTrace);
   }
+  MsgTrace& t = gTraces[gTraceHead];
+  memset(&t, 0, sizeof(t));
+  t.seq = gRxSeq;
+  t.via = gRxVia;
+  t.atUs[TR_RX] = gRxUs;
+  gTraceHead = (uint8_t)((gTraceHead + 1) % kTraceRing);
+  if (gTraceCount < kTraceRing) gTraceCount++;
+  gActiveTrace = &t;
+}
 
-  // Time per block (>= 1 us)
-  uint32_t us_per_blk = (duration_ms * 1000UL) / (N ? N : 1);
-  if (us_per_blk == 0) us_per_blk = 1;
+static void traceMark(TraceStage stage) {
+  if (gActiveTrace && !gActiveTrace->atUs[stage]) gActiveTrace->atUs[stage] = micros();
+}
 
-  for (uint32_t k = 0; k < N; ++k) {
-    uint16_t p = idx[k];
-    int16_t bx = (p % nx) * block;
-    int16_t by = (p / nx) * block;
-    uint16_t bw = (bx + block > w) ? (w - bx) : block;
-    uint16_t bh = (by + block > h) ? (h - by) : block;
-    dma_display->fillRect(bx, by, bw, bh, 0); // black tile
-    delayMicroseconds(us_per_blk);
+// One line per trace; stage times are relative to receipt.
+static void printTrace(const MsgTrace& t, Print& out) {
+  out.printf("[TRACE] seq=%lu via=%s", (unsigned long)t.seq, kViaNames[t.via]);
+  for (uint8_t s = TR_DISSOLVE; s < TR_COUNT; ++s) {
+    if (t.atUs[s]) out.printf(" %s=+%lu", kTraceStageNames[s], (unsigned long)(t.atUs[s] - t.atUs[TR_RX]));
   }
-  free(idx);
+  out.println(t.superseded ? " us superseded" : " us");
 }
 
-// Accept POST body with 6 lines, set as live text and trigger sequence
-void handlePost() {
-  if (!server.hasArg("plain")) {
-    server.send(400, "text/plain", "no body");
-    return;
+// Log a finished or superseded trace and echo it to the BLE central if it came that way.
+static void reportTrace(const MsgTrace& t) {
+  AllocScope tag(ALLOC_LOG);
+  printTrace(t, Serial);
+  #if ENABLE_BT
+  if (t.via == VIA_BLE) {
+    BleTxPrint out;
+    printTrace(t, out);
+    out.flush();
   }
-  gLiveText = server.arg("plain");
-  gHasLiveText = true;
-  kNewLivePending = true; // trigger dissolve -> thinking -> typewriter
-  server.send(200, "text/plain", "ok");
+  #endif
 }
 
-// BLE RX is handled in RxCallbacks::onWrite; nothing to poll here.
-void processBluetooth() {
-#if ENABLE_BT
-  // BLE RX is handled in RxCallbacks::onWrite; nothing to poll here.
+static void printTraces(Print& out) {
+  for (uint8_t i = 0; i < gTraceCount; ++i) {
+    printTrace(gTraces[(gTraceHead + kTraceRing - gTraceCount + i) % kTraceRing], out);
+  }
+  out.printf("[TRACE] end rx_usb=%lu rx_ble=%lu rx_http=%lu overwritten=%lu"
+             " rejected_usb=%lu rejected_ble=%lu rejected_http=%lu usb_stalls=%lu\n",
+             (unsigned long)gRxCount[VIA_USB], (unsigned long)gRxCount[VIA_BLE],
+             (unsigned long)gRxCount[VIA_HTTP], (unsigned long)gRxOverwritten,
+             (unsigned long)gRxRejected[VIA_USB], (unsigned long)gRxRejected[VIA_BLE],
+             (unsigned long)gRxRejected[VIA_HTTP], (unsigned long)gRxUsbStalls);
+}
+
+// ===== Idle mode =====
+// When nothing is animating, the loop task blocks on a task notification
+// instead of spinning. The I2S DMA keeps scanning the panel by itself and the
+// FreeRTOS idle task clock-gates the CPU (WAITI) meanwhile. BLE messages and
+// UART bytes notify us early; otherwise we wake at the next deadline.
+// Light sleep is deliberately not used: it gates the APB clock, which would
+// freeze the DMA scanout on a single row.
+#ifndef IDLE_HTTP_POLL_MS
+#define IDLE_HTTP_POLL_MS 20   // WebServer has no wake hook, so poll it at this rate
 #endif
+
+static TaskHandle_t gLoopTask = nullptr;
+static volatile uint32_t gWakeStampUs = 0;  // micros() of the most recent wake event
+
+struct IdleStats {
+  uint32_t windowStartMs = 0;
+  uint32_t idleUs        = 0;   // time blocked in the current window
+  uint32_t wakes         = 0;   // early wakes (event before deadline)
+  uint32_t w2rCount      = 0;   // wake-to-render samples
+  uint32_t w2rSumUs      = 0;
+  uint32_t w2rMaxUs      = 0;
+};
+static IdleStats gIdle;
+
+// Called from the BLE host task / UART event task when there is work for loop().
+static void wakeLoop() {
+  gWakeStampUs = micros();
+  if (gLoopTask) xTaskNotifyGive(gLoopTask);
 }
 
-// Read 6 newline-terminated lines from USB Serial
-void processUSB() {
-  static String usbAccum;
-  while (Serial.available()) {
-    char c = (char)Serial.read();
-    usbAccum += c;
-    if (usbAccum.length() > 4096) usbAccum.remove(0, usbAccum.length() - 2048);
+// ===== Clock =====
+// All state-machine timing (loop phases, dissolve, typewriter, frame pacing,
+// idle waits) goes through gClock, so the whole cycle can also run on
+// simulated time (see runSim()).
+struct Clock {
+  virtual uint32_t nowMs() = 0;
+  virtual uint32_t nowUs() = 0;
+  virtual void sleepMs(uint32_t ms) = 0;
+  // Idle for up to `ms`; may return early when there is work to do.
+  virtual void idle(uint32_t ms) = 0;
+};
+
+struct ArduinoClock : Clock {
+  uint32_t nowMs() override { return millis(); }
+  uint32_t nowUs() override { return micros(); }
+  // A planned pacing sleep: counted as idle, not busy, like idle() below
+  void sleepMs(uint32_t ms) override {
+    uint32_t t0 = micros();
+    delay(ms);
+    uint32_t dt = micros() - t0;
+    gIdle.idleUs += dt;
+    gIdleUsTotal += dt;
   }
-  if (usbAccum.indexOf('\n') != -1) {
-    gLiveText = usbAccum;
-    gHasLiveText = true;
-    kNewLivePending = true;
-    usbAccum = "";
+  void idle(uint32_t ms) override {
+    if (kNewLivePending || Serial.available()) return;
+    #if ENABLE_HTTP_SERVER
+    if (ms > IDLE_HTTP_POLL_MS) ms = IDLE_HTTP_POLL_MS;
+    #endif
+    TlScope tl(TL_IDLE);
+    uint32_t t0 = micros();
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms)) > 0) gIdle.wakes++;
+    uint32_t dt = micros() - t0;
+    gIdle.idleUs += dt;
+    gIdleUsTotal += dt;
   }
-}
+};
 
-// Draw the six lines with their colors, 10px spacing
-void drawSixLines() {
-  const String &src = gHasLiveText ? gLiveText : gCannedText[currentPhilo];
-  drawWrappedGradient(src, -1); // full text, gradient per visual line
-}
-
-// Helper to build combined canned sentences from the 6-line arrays
-static void buildCannedCombined() {
-  gCannedCount = 0;
-  for (int i = 0; i < kNumPhilos && i < 16; ++i) {
-    String s;
-    for (int l = 0; l < 6; ++l) {
-      if (l) s += ' ';
-      s += kPhilosophies[i][l];
-    }
-    gCannedText[gCannedCount++] = s;
+// Virtual time: sleeping and idling just advance the counter.
+struct SimClock : Clock {
+  uint64_t us = 0;
+  uint32_t nowMs() override { return (uint32_t)(us / 1000ULL); }
+  uint32_t nowUs() override { return (uint32_t)us; }
+  void sleepMs(uint32_t ms) override { us += (uint64_t)ms * 1000ULL; }
+  void idle(uint32_t ms) override { us += (uint64_t)ms * 1000ULL; }
+};
+
+static ArduinoClock gRealClock;
+static Clock* gClock = &gRealClock;
+
+// Block until deadlineMs (gClock time) or until something calls wakeLoop().
+static void idleWait(uint32_t deadlineMs) {
+  int32_t left = (int32_t)(deadlineMs - gClock->nowMs());
+  if (left <= 0) return;
+  // A USB text frame is waiting for its quiet gap; come back to end it
+  if (gUsbPending && gClock == &gRealClock) {
+    const int32_t quiet = (int32_t)(gUsbRxMs + USB_QUIET_MS - millis());
+    if (quiet < left) left = quiet > 0 ? quiet : 1;
   }
+  gClock->idle((uint32_t)left);
 }
 
-// Render "thinking" at bottom with optional flashing cursor
-void renderThining(bool cursorOn) {
-  const int textH = 8; // default font height
-  const int y = PANEL_RES_Y - textH;
-  dma_display->fillRect(0, y, dma_display->width(), textH, 0); // clear bottom strip across both panels
-  dma_display->setCursor(0, y);
-  dma_display->setTextColor(dma_display->color565(255, 255, 0)); // yellow
-  dma_display->print("thinking");
-  if (cursorOn) dma_display->print("_");
+// Record the time from the wake event that delivered a message to its first draw.
+static void noteWakeToRender(uint32_t wokeUs) {
+  uint32_t dt = micros() - wokeUs;
+  gIdle.w2rCount++;
+  gIdle.w2rSumUs += dt;
+  if (dt > gIdle.w2rMaxUs) gIdle.w2rMaxUs = dt;
 }
 
-// ===== Minimal panel config (pins) =====
-static void initPanel() {
+// Once a minute, log loop-task CPU utilization and wake latency, then reset.
+static void idleReport() {
+  uint32_t now = millis();
+  uint32_t windowMs = now - gIdle.windowStartMs;
+  if (windowMs < 60000UL) return;
+  AllocScope tag(ALLOC_LOG);
+  uint32_t busyPermille = 1000UL - (uint32_t)((uint64_t)gIdle.idleUs / windowMs);
+  Serial.printf("[IDLE] cpu=%lu.%lu%% wakes=%lu wake->render avg=%lu us max=%lu us (n=%lu)\n",
+                (unsigned long)(busyPermille / 10), (unsigned long)(busyPermille % 10),
+                (unsigned long)gIdle.wakes,
+                (unsigned long)(gIdle.w2rCount ? gIdle.w2rSumUs / gIdle.w2rCount : 0),
+                (unsigned long)gIdle.w2rMaxUs, (unsigned long)gIdle.w2rCount);
+  gIdle = IdleStats();
+  gIdle.windowStartMs = now;
+}
+
+#if ENABLE_BT
+// Hand a complete BLE frame to the loop: commands via bleCommand, text as the
+// pending live message.
+static void bleDeliver(TextRef& frame) {
+  if (frame.c_str()[0] == '/') {
+    TextRef stale;   // an unread command, freed outside the critical section
+    portENTER_CRITICAL(&bleCommandMux);
+    stale = std::move(bleCommand);
+    bleCommand = std::move(frame);
+    bleCommandPending = true;
+    portEXIT_CRITICAL(&bleCommandMux);
+  } else {
+    noteReceipt(VIA_BLE, frame);
+    textPublish(std::move(frame));
+    kNewLivePending = true;
+  }
+  bleStatsMessage();
+}
+
+// Define the onWrite now that globals above are declared
+void RxCallbacks::onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*connInfo*/) {
+  const uint32_t t0 = micros();
+  TlScope tl(TL_BLE_CB);
+  AllocScope tag(ALLOC_BLE);
+  const NimBLEAttValue v = c->getValue();   // NimBLE copies the value out of the attribute
+  if (v.size() == 0) return;
+  bleStatsWrite(v.size());
+  // Commands end at their newline, text at the end of the write (see rxFeed)
+  static RxFramer framer;
+  const char* p = (const char*)v.data();
+  size_t n = v.size();
+  bool woke = false;
+  while (n) {
+    const RxStatus st = rxFeed(framer, p, n);
+    if (st == RX_FRAME) {
+      bleDeliver(framer.buf);
+      woke = true;
+    } else if (st == RX_REJECTED) {
+      gRxRejected[VIA_BLE]++;
+      bleNakPending = true;
+      woke = true;
+    }
+  }
+  if (rxEnd(framer) == RX_FRAME) {
+    bleDeliver(framer.buf);
+    woke = true;
+  }
+  if (woke) wakeLoop();
+  gLoopMon.noteCallback(SEC_BLE_CB, micros() - t0);
+}
+#endif
+
+// ===== Text geometry =====
+// Two chained 64x64 panels = 128px wide. Using 5x7 font + 1px spacing ≈ 6 px/char -> ~21 cols
+static const uint8_t kCols = 21;        // used for cursor advance only (wrap is automatic)
+
+// ===== Trite philosophies (each line exactly 10 chars) =====
+// One X(...) per canned set, six panel lines each. The table below is built
+// by the compiler: every set becomes a single '\n'-joined literal in flash,
+// already laid out one panel row per line, so adding sets costs no RAM and
+// no boot time.
+#define PHILOSOPHIES(X) \
+  X("Life is   ", "mostly fog", "and echoes", "of old tea", "cooling so", "again hmm.") \
+  X("Truth: meh", "we nod now", "meaning is", "soft so so", "for a bit.", "then naps.") \
+  X("Time hums.", "like a fan", "in a small", "we call it", "and stays.", "same as me") \
+  X("Hope shows", "then hides", "we shrug a", "little bit", "and sip we", "again sure") \
+  X("Meaning is", "just a map", "of places ", "we drew on", "in the fog", "last night") \
+  X("Mind drift", "over pools", "of bright ", "dot we map", "then we nap", "by morning")
+
+#define PHILO_TEXT(a, b, c, d, e, f) a "\n" b "\n" c "\n" d "\n" e "\n" f,
+static const char* const kCannedText[] = { PHILOSOPHIES(PHILO_TEXT) };
+#undef PHILO_TEXT
+
+// Rows are not wrapped when drawn, so a line wider than the panel would be clipped.
+#define PHILO_FITS(a, b, c, d, e, f)                                                        \
+  static_assert(sizeof(a) <= kCols + 1 && sizeof(b) <= kCols + 1 && sizeof(c) <= kCols + 1 && \
+                sizeof(d) <= kCols + 1 && sizeof(e) <= kCols + 1 && sizeof(f) <= kCols + 1,   \
+                "canned line wider than the panel");
+PHILOSOPHIES(PHILO_FITS)
+#undef PHILO_FITS
+
+static const int kNumPhilos = sizeof(kCannedText) / sizeof(kCannedText[0]);
+// /bench and /golden cover the first few sets, however long the library grows.
+static const int kCannedChecked = kNumPhilos < 16 ? kNumPhilos : 16;
+static int currentPhilo = 0; // index into kCannedText
+
+// Target brightness for normal view
+// Increase for daylight readability (0..255). Was 60.
+static const uint8_t kTargetBrightness = 120;
+
+// ===== Frame/section histograms =====
+// Always-on profiling on the CPU cycle counter. Log-linear ("HDR-style")
+// buckets: 4 per power of two from 256 cycles (~1 us) up, so every recorded
+// value is within ~19% of its bucket. Frames are keyed by the ScreenState
+// they ran in; the heavy draw routines get a histogram each. `/hist` dumps
+// them (serial or NUS TX) and resets.
+static const uint8_t kHistMinShift = 8;
+static const uint8_t kHistBuckets  = (32 - kHistMinShift) * 4 + 1;
+
+struct CycleHist {
+  uint32_t n = 0;
+  uint32_t maxC = 0;
+  uint64_t sumC = 0;
+  uint32_t bucket[kHistBuckets] = {0};
+
+  static uint8_t bucketOf(uint32_t c) {
+    if (c < (1UL << kHistMinShift)) return 0;
+    uint8_t msb = (uint8_t)(31 - __builtin_clz(c));
+    return (uint8_t)(1 + (msb - kHistMinShift) * 4 + ((c >> (msb - 2)) & 3));
+  }
+  // Upper edge of a bucket, in cycles.
+  static uint32_t bucketHigh(uint8_t b) {
+    if (b == 0) return (1UL << kHistMinShift) - 1;
+    uint8_t msb = (uint8_t)(kHistMinShift + (b - 1) / 4);
+    uint64_t lo = (1ULL << msb) + ((uint64_t)((b - 1) % 4) << (msb - 2));
+    return (uint32_t)(lo + (1ULL << (msb - 2)) - 1);
+  }
+
+  void add(uint32_t c) {
+    n++;
+    sumC += c;
+    if (c > maxC) maxC = c;
+    bucket[bucketOf(c)]++;
+  }
+
+  uint32_t percentile(uint32_t permille) const {
+    if (!n) return 0;
+    uint64_t want = ((uint64_t)n * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint8_t b = 0; b < kHistBuckets; ++b) {
+      seen += bucket[b];
+      if (seen >= want) return bucketHigh(b) < maxC ? bucketHigh(b) : maxC;
+    }
+    return maxC;
+  }
+};
+
+enum ProfSection : uint8_t { PROF_GRADIENT, PROF_SPAN, PROF_THINKING, PROF_DISSOLVE, PROF_COUNT };
+static const char* const kProfNames[PROF_COUNT] = {
+  "drawWrappedGradient", "drawGradientSpan", "renderThining", "dissolveClearBlocks"
+};
+static const uint8_t kProfStates = 6; // ScreenState count (enum is declared further down)
+
+struct Profiler {
+  bool on = true;            // off while the state machine runs on simulated time
+  uint8_t state = 0;         // ScreenState the current frame belongs to
+  CycleHist frame[kProfStates];
+  CycleHist section[PROF_COUNT];
+};
+static Profiler gProf;
+
+// Adds the enclosing scope's cycle count to a histogram.
+struct CycleScope {
+  CycleHist& h;
+  uint32_t c0;
+  explicit CycleScope(CycleHist& hist) : h(hist), c0(ESP.getCycleCount()) {}
+  ~CycleScope() { if (gProf.on) h.add(ESP.getCycleCount() - c0); }
+};
+
+// ===== Frame-rate governor =====
+// Paces the animated states to a fixed frame budget and measures what each
+// frame actually cost. A run of overruns steps `quality` down, which coarsens
+// optional work (bigger dissolve tiles, append-only typewriter draws) until
+// frames fit again; sustained headroom steps it back up.
+#ifndef TARGET_FPS
+#define TARGET_FPS 40
+#endif
+
+struct FrameGovernor {
+  static const uint8_t kMaxQuality = 3;          // 0 = full quality
+  uint32_t budgetUs     = 1000000UL / TARGET_FPS;
+  uint32_t frameStartUs = 0;
+  uint32_t frameStartCycles = 0;
+  uint32_t lastCostUs   = 0;
+  uint32_t avgCostUs    = 0;   // EWMA of frame cost, 1/8 weight
+  uint32_t overruns     = 0;   // frames over budget since boot
+  uint8_t  quality      = 0;
+  uint8_t  overStreak   = 0;
+  uint8_t  underStreak  = 0;
+  bool     logChanges   = true;   // off during /sim, /bench and /golden runs
+
+  void beginFrame() {
+    tlEvent(TL_FRAME, TL_BEGIN);
+    frameStartUs = gClock->nowUs();
+    frameStartCycles = ESP.getCycleCount();
+  }
+
+  // Record the frame's render cost and adapt quality.
+  void endFrame() {
+    tlEvent(TL_FRAME, TL_END);
+    lastCostUs = gClock->nowUs() - frameStartUs;
+    if (gProf.on) gProf.frame[gProf.state].add(ESP.getCycleCount() - frameStartCycles);
+    avgCostUs = avgCostUs ? avgCostUs - (avgCostUs >> 3) + (lastCostUs >> 3) : lastCostUs;
+    if (lastCostUs > budgetUs) {
+      overruns++;
+      underStreak = 0;
+      if (++overStreak >= 3 && quality < kMaxQuality) {
+        overStreak = 0;
+        quality++;
+        if (logChanges) {
+          Serial.printf("[FPS] %lu us > %lu us budget, quality -> %u\n",
+                        (unsigned long)lastCostUs, (unsigned long)budgetUs, quality);
+        }
+      }
+    } else {
+      overStreak = 0;
+      if (lastCostUs < budgetUs / 2 && ++underStreak >= 2 * TARGET_FPS && quality > 0) {
+        underStreak = 0;
+        quality--;
+        if (logChanges) Serial.printf("[FPS] headroom, quality -> %u\n", quality);
+      }
+    }
+  }
+
+  // Sleep out whatever is left of the budget (yields to the BLE/Wi-Fi tasks).
+  void pace() {
+    uint32_t spent = gClock->nowUs() - frameStartUs;
+    if (spent < budgetUs) gClock->sleepMs((budgetUs - spent) / 1000UL);
+  }
+
+  // Dissolve tile edge for the current quality: 4 -> 6 -> 8 -> 10 px for base 4.
+  uint8_t tileSize(uint8_t base) const { return (uint8_t)(base + quality * base / 2); }
+};
+static FrameGovernor gGovernor;
+
+// ===== Dynamic per-line color palette =====
+static uint16_t gLineColors[6] = {0};
+static uint8_t  gPaletteBase[3] = {0}; // base RGB the current palette was built from
+
+static inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t t /*0..255*/) {
+  return (uint8_t)(((uint16_t)a * (255 - t) + (uint16_t)b * t + 127) / 255);
+}
+
+// Build a palette where line 0 is white and line 5 is the solid base color.
+static void makePaletteFromBase(uint8_t br, uint8_t bg, uint8_t bb) {
+  gPaletteBase[0] = br; gPaletteBase[1] = bg; gPaletteBase[2] = bb;
+  for (int i = 0; i < 6; ++i) {
+    // t from 0 (top/white) to 255 (bottom/base)
+    uint8_t t = (uint8_t)(i * (255 / 5));
+    uint8_t r = lerp8(255, br, t);
+    uint8_t g = lerp8(255, bg, t);
+    uint8_t b = lerp8(255, bb, t);
+    gLineColors[i] = color565(r, g, b);
+  }
+}
+
+// Pick a saturated random base color and build the palette.
+static void randomizePalette() {
+  // Ensure it's not too close to white/grey: pick one channel high, others random.
+  uint8_t which = (uint8_t)random(3); // 0=r,1=g,2=b
+  uint8_t r = (which == 0) ? 255 : (uint8_t)random(40, 221);
+  uint8_t g = (which == 1) ? 255 : (uint8_t)random(40, 221);
+  uint8_t b = (which == 2) ? 255 : (uint8_t)random(40, 221);
+  makePaletteFromBase(r, g, b);
+}
+
+// ===== Indexed framebuffer =====
+// Text only ever uses the six gLineColors plus black. With INDEXED_FB=1 the
+// renderers draw into an IndexedGfx that passes every pixel on to the panel
+// and keeps a 4-bit map of which palette slot it came from (4 KB at 128x64).
+// The renderers name the slot (indexLine) rather than it being looked up by
+// colour, since two lines of a pale gradient can share one RGB565 value.
+// A palette change is then applied by recolourScreen(), which pushes just the
+// line-coloured pixels with their new colour: no glyph is rasterized again.
+// PALETTE_CYCLE_MS > 0 uses that to rotate the gradient while a message is up.
+#ifndef INDEXED_FB
+#define INDEXED_FB 0
+#endif
+#ifndef PALETTE_CYCLE_MS
+#define PALETTE_CYCLE_MS 0
+#endif
+#if PALETTE_CYCLE_MS && !INDEXED_FB
+#error "PALETTE_CYCLE_MS needs INDEXED_FB=1"
+#endif
+
+#if INDEXED_FB
+class IndexedGfx : public Adafruit_GFX {
+ public:
+  static const int16_t kW = PANEL_RES_X * PANEL_CHAIN, kH = PANEL_RES_Y;
+  Adafruit_GFX* target = nullptr;
+  uint8_t map[kW * kH / 2];   // two pixels per byte, low nibble first; 0 = not a line colour
+  uint8_t slot = 0;           // gLineColors index + 1 for what is drawn next; 0 = none
+
+  IndexedGfx() : Adafruit_GFX(kW, kH) { memset(map, 0, sizeof(map)); }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t c) override {
+    if (x < 0 || y < 0 || x >= kW || y >= kH) return;
+    set(x, y, c ? slot : 0);
+    target->drawPixel(x, y, c);
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c) override {
+    const uint8_t v = c ? slot : 0;
+    int16_t x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int16_t x1 = x + w > kW ? kW : x + w, y1 = y + h > kH ? kH : y + h;
+    for (int16_t yy = y0; yy < y1; ++yy) {
+      for (int16_t xx = x0; xx < x1; ++xx) set(xx, yy, v);
+    }
+    target->fillRect(x, y, w, h, c);
+  }
+  void fillScreen(uint16_t c) override {
+    memset(map, (c ? slot : 0) * 0x11, sizeof(map));
+    target->fillScreen(c);
+  }
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t c) override { fillRect(x, y, w, 1, c); }
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t c) override { fillRect(x, y, 1, h, c); }
+
+  // Redraw every line-coloured pixel to `dst` in the current palette; returns
+  // how many there were.
+  uint32_t recolour(Adafruit_GFX& dst) const {
+    uint32_t n = 0;
+    for (int16_t y = 0; y < kH; ++y) {
+      const uint8_t* row = map + y * (kW / 2);
+      for (int16_t x = 0; x < kW; x += 2) {
+        const uint8_t b = row[x / 2];
+        if (!b) continue;
+        if (b & 0x0F) { dst.drawPixel(x, y, gLineColors[(b & 0x0F) - 1]); n++; }
+        if (b >> 4) { dst.drawPixel(x + 1, y, gLineColors[(b >> 4) - 1]); n++; }
+      }
+    }
+    return n;
+  }
+
+ private:
+  void set(int16_t x, int16_t y, uint8_t v) {
+    uint8_t& b = map[(y * kW + x) >> 1];
+    b = (x & 1) ? (uint8_t)((b & 0x0F) | (v << 4)) : (uint8_t)((b & 0xF0) | v);
+  }
+};
+static IndexedGfx gIndexed;
+
+// Apply the current gLineColors to what is on the panel.
+static void recolourScreen() {
+  gIndexed.recolour(*gIndexed.target);
+}
+
+#if PALETTE_CYCLE_MS
+// Move every line's colour one slot down the gradient.
+static void cyclePalette() {
+  const uint16_t first = gLineColors[0];
+  memmove(gLineColors, gLineColors + 1, 5 * sizeof(gLineColors[0]));
+  gLineColors[5] = first;
+  recolourScreen();
+}
+#endif
+#endif
+
+// Mark what the renderer draws next as gradient line `lineIdx` (clamped to
+// the base colour past 5), or -1 for anything else.
+static inline void indexLine(int lineIdx) {
+#if INDEXED_FB
+  gIndexed.slot = lineIdx < 0 ? 0 : (uint8_t)((lineIdx < 6 ? lineIdx : 5) + 1);
+#else
+  (void)lineIdx;
+#endif
+}
+
+// ===== Utilities =====
+// Font for the message renderers: the built-in 5x7 (nullptr) unless the asset
+// partition has a "text" font (assetTextFont). Rows stay 10 px apart either
+// way; a GFX font draws up from its baseline, set kFontBaseline into the row.
+static const GFXfont* gTextFont = nullptr;
+static const int16_t kFontBaseline = 8;
+
+static inline int16_t textRowY(int lineIdx) {
+  return (int16_t)(lineIdx * 10 + (gTextFont ? kFontBaseline : 0));
+}
+
+static inline uint8_t textAdvance(char ch) {
+  if (!gTextFont) return 6;
+  const uint8_t c = (uint8_t)ch;
+  if (c < gTextFont->first || c > gTextFont->last) return 0;
+  return gTextFont->glyph[c - gTextFont->first].xAdvance;
+}
+
+// Render multi-line text with a white->base gradient per visual line.
+// If revealChars >= 0, only the first `revealChars` characters across all lines are drawn (typewriter).
+static void drawWrappedGradient(const char* text, int32_t revealChars /* -1 = full */) {
+  CycleScope prof(gProf.section[PROF_GRADIENT]);
+  TlScope tl(TL_GRADIENT);
+  AllocScope tag(ALLOC_RENDER);
+  gfx->fillScreen(0);
+  gfx->setTextWrap(false); // we manage wrapping upstream (Python) to avoid word splits
+  gfx->setFont(gTextFont);
+
+  int lineIdx = 0;           // visual line index for gradient color
+  int shown = 0;             // total characters drawn so far
+
+  const char* line = text;
+  while (*line) {
+    const char* end = strchr(line, '\n');
+    if (!end) end = line + strlen(line);
+
+    // Determine how many chars of this line to draw under the reveal limit
+    int toShow = (int)(end - line);
+    if (revealChars >= 0) {
+      int remaining = revealChars - shown;
+      if (remaining <= 0) break;
+      if (toShow > remaining) toShow = remaining;
+    }
+
+    // Color for this visual line (clamp past 5 to the base color)
+    uint16_t col = gLineColors[(lineIdx < 6) ? lineIdx : 5];
+    gfx->setCursor(0, textRowY(lineIdx));
+    gfx->setTextColor(col);
+    indexLine(lineIdx);
+    for (int i = 0; i < toShow; ++i) {
+      gfx->print(line[i]);
+    }
+
+    shown += toShow;
+    if (revealChars >= 0 && shown >= revealChars) break;
+
+    lineIdx++;   // next 10 px text row
+    line = *end ? end + 1 : end; // skip the newline we consumed
+  }
+  indexLine(-1);
+  gfx->setFont(nullptr);
+}
+
+// Number of characters drawWrappedGradient counts toward a reveal (everything but '\n').
+static size_t visibleLength(const char* text) {
+  size_t n = 0;
+  for (; *text; ++text) if (*text != '\n') n++;
+  return n;
+}
+
+// Draw only revealed characters [from, to) at the positions drawWrappedGradient
+// would use, without clearing. Lets the typewriter append glyphs instead of
+// redrawing the whole screen each step.
+static void drawGradientSpan(const char* text, int32_t from, int32_t to) {
+  CycleScope prof(gProf.section[PROF_SPAN]);
+  TlScope tl(TL_SPAN);
+  AllocScope tag(ALLOC_RENDER);
+  gfx->setFont(gTextFont);
+  int lineIdx = 0, x = 0;
+  int32_t shown = 0;
+  for (const char* p = text; *p && shown < to; ++p) {
+    char ch = *p;
+    if (ch == '\n') { lineIdx++; x = 0; continue; }
+    if (ch != '\r') {
+      if (shown >= from) {
+        uint16_t c = gLineColors[(lineIdx < 6) ? lineIdx : 5];
+        indexLine(lineIdx);
+        gfx->drawChar((int16_t)x, textRowY(lineIdx), ch, c, c, 1);
+      }
+      x += textAdvance(ch);
+    }
+    shown++;
+  }
+  indexLine(-1);
+  gfx->setFont(nullptr);
+}
+
+#if STATIC_ALLOC
+// Shuffle orders for the dissolve, sized for the whole chain; tiles are never
+// smaller than kDissolveMinBlock. [0] is the screen machine's, which spans
+// loop() iterations; [1] serves blocking and simulated runs in between.
+static const uint8_t kDissolveMinBlock = 4;
+static const uint32_t kDissolveMaxTiles =
+    ((PANEL_RES_X * PANEL_CHAIN + kDissolveMinBlock - 1) / kDissolveMinBlock) *
+    ((PANEL_RES_Y + kDissolveMinBlock - 1) / kDissolveMinBlock);
+static uint16_t gDissolveTiles[2][kDissolveMaxTiles];
+#endif
+
+// Clear screen in random blocks for a very visible dissolve, one frame per
+// step() so the caller can hand the loop back between frames.
+// block = tile size (e.g., 4 px), durationMs is total animation time.
+struct Dissolve {
+  uint16_t* idx = nullptr;   // shuffled tile order; null when not running
+  uint32_t  n = 0, k = 0;    // tiles in total / cleared so far
+  uint32_t  t0 = 0, durationMs = 0;
+  uint16_t  w = 0, h = 0, nx = 0;
+  uint8_t   block = 4;
+
+  Dissolve() {}
+  Dissolve(const Dissolve&) = delete;
+  Dissolve& operator=(const Dissolve&) = delete;
+  ~Dissolve() { end(); }
+
+  bool active() const { return idx != nullptr; }
+
+  bool begin(uint16_t w_, uint16_t h_, uint32_t ms, uint8_t blk, uint8_t slot) {
+    end();
+    AllocScope tag(ALLOC_DISSOLVE);
+    #if STATIC_ALLOC
+    if (blk < kDissolveMinBlock) blk = kDissolveMinBlock;
+    #endif
+    w = w_; h = h_; durationMs = ms; block = blk;
+    nx = (uint16_t)((w + block - 1) / block);
+    n = (uint32_t)nx * (uint32_t)((h + block - 1) / block);
+    #if STATIC_ALLOC
+    if (n > kDissolveMaxTiles) return false;
+    idx = gDissolveTiles[slot];
+    #else
+    (void)slot;
+    idx = (uint16_t*)malloc(n * sizeof(uint16_t));
+    if (!idx) return false;
+    #endif
+
+    for (uint32_t i = 0; i < n; ++i) idx[i] = (uint16_t)i;
+
+    // Fisher–Yates shuffle
+    for (uint32_t i = n - 1; i > 0; --i) {
+      uint32_t j = (uint32_t)random(i + 1);
+      uint16_t t = idx[i]; idx[i] = idx[j]; idx[j] = t;
+    }
+    k = 0;
+    t0 = gClock->nowMs();
+    return true;
+  }
+
+  // Clear up to where elapsed time says we should be (at least one tile), so
+  // slow fills cost frames rather than stretching the duration. Returns true
+  // once the screen is clear.
+  bool step() {
+    if (!idx) return true;
+    CycleScope prof(gProf.section[PROF_DISSOLVE]);
+    TlScope tl(TL_DISSOLVE);
+    uint32_t elapsed = gClock->nowMs() - t0;
+    uint32_t due = (elapsed >= durationMs) ? n : (uint32_t)((uint64_t)n * elapsed / durationMs);
+    if (due <= k) due = k + 1;
+    for (; k < due; ++k) {
+      uint16_t p = idx[k];
+      int16_t bx = (p % nx) * block;
+      int16_t by = (p / nx) * block;
+      uint16_t bw = (bx + block > w) ? (w - bx) : block;
+      uint16_t bh = (by + block > h) ? (h - by) : block;
+      gfx->fillRect(bx, by, bw, bh, 0); // black tile
+    }
+    if (k < n) return false;
+    end();
+    return true;
+  }
+
+  void end() {
+    #if !STATIC_ALLOC
+    free(idx);
+    #endif
+    idx = nullptr;
+  }
+};
+
+// The whole dissolve in one call, paced by the governor (benchmarks, golden frames).
+void dissolveClearBlocks(uint16_t w, uint16_t h, uint32_t duration_ms, uint8_t block = 4) {
+  Dissolve d;
+  if (!d.begin(w, h, duration_ms, block, 1)) return;
+  for (;;) {
+    gGovernor.beginFrame();
+    const bool done = d.step();
+    gGovernor.endFrame();
+    if (done) break;
+    gGovernor.pace();
+  }
+}
+
+// Accept POST body with 6 lines, set as live text and trigger sequence
+void handlePost() {
+  if (!server.hasArg("plain")) {
+    server.send(400, "text/plain", "no body");
+    return;
+  }
+  const String& body = server.arg("plain");   // WebServer's own copy; ours is the TextBuf
+  TextRef text = textAlloc();
+  if (!text || !text.append(body.c_str(), body.length())) {
+    gRxRejected[VIA_HTTP]++;
+    server.send(text ? 413 : 503, "text/plain", text ? "too long" : "busy");
+    return;
+  }
+  noteReceipt(VIA_HTTP, text);
+  textPublish(std::move(text));
+  kNewLivePending = true; // trigger dissolve -> thinking -> typewriter
+  server.send(200, "text/plain", "ok");
+}
+
+static void handleCommand(const char* line, Print& out);
+
+#if ENABLE_HTTP_SERVER
+// GET /trace: the same report as the `/trace` command
+void handleTraceGet() {
+  StreamString body;
+  printTraces(body);
+  server.send(200, "text/plain", body);
+}
+#endif
+
+// BLE RX text is handled in RxCallbacks::onWrite; commands are run here so
+// their output (notifications) is produced on the loop task.
+void processBluetooth() {
+#if ENABLE_BT
+  if (bleNakPending) {
+    bleNakPending = false;
+    AllocScope tag(ALLOC_LOG);
+    BleTxPrint out;
+    printNak(VIA_BLE, out);
+    out.flush();
+  }
+  if (!bleCommandPending) return;
+  TextRef cmd;
+  portENTER_CRITICAL(&bleCommandMux);
+  cmd = std::move(bleCommand);
+  bleCommandPending = false;
+  portEXIT_CRITICAL(&bleCommandMux);
+  BleTxPrint out;
+  handleCommand(cmd.c_str(), out);
+  out.flush();
+#endif
+}
+
+// Read USB Serial: commands as soon as their line ends, text once the UART
+// has been quiet for USB_QUIET_MS (see rxFeed)
+static void usbDeliver(TextRef& frame) {
+  if (frame.c_str()[0] == '/') {
+    handleCommand(frame.c_str(), Serial);
+    frame.clear();
+    return;
+  }
+  noteReceipt(VIA_USB, frame);
+  textPublish(std::move(frame));
+  kNewLivePending = true;
+}
+
+void processUSB() {
+  AllocScope tag(ALLOC_USB);
+  static RxFramer framer;
+  static bool stalled = false;
+  while (Serial.available()) {
+    if (!framer.buf && !framer.skipping) {
+      framer.buf = textAlloc();
+      if (!framer.buf) {   // backpressure: leave the bytes in the UART buffer
+        if (!stalled) gRxUsbStalls++;
+        stalled = true;
+        return;
+      }
+      stalled = false;
+    }
+    char chunk[64];
+    const char* p = chunk;
+    size_t n = Serial.read((uint8_t*)chunk, sizeof(chunk));
+    gUsbRxMs = millis();
+    gUsbPending = true;
+    while (n) {
+      const RxStatus st = rxFeed(framer, p, n);
+      if (st == RX_FRAME) {
+        usbDeliver(framer.buf);
+      } else if (st == RX_REJECTED) {
+        gRxRejected[VIA_USB]++;
+        printNak(VIA_USB, Serial);
+      }
+    }
+  }
+  if (!gUsbPending || millis() - gUsbRxMs < USB_QUIET_MS) return;
+  gUsbPending = false;
+  if (rxEnd(framer) == RX_FRAME) usbDeliver(framer.buf);
+}
+
+// What the panel shows: the live message if there is one, else the canned set.
+static const char* displayText() {
+  return gHasLiveText ? gLiveText.c_str() : kCannedText[currentPhilo];
+}
+
+// Draw the six lines with their colors, 10px spacing
+void drawSixLines() {
+  drawWrappedGradient(displayText(), -1); // full text, gradient per visual line
+}
+
+// ===== Warm start =====
+// What is (or is about to be) on the panel survives a brownout / watchdog
+// reset: RTC slow memory first, NVS as the fallback when RTC did not survive.
+// On boot it is redrawn in full straight away, skipping the transition.
+static const uint32_t kWarmMagic   = 0x4C4E5050; // "PPNL"
+static const size_t   kWarmTextMax = 512;
+
+struct WarmState {
+  uint32_t magic;
+  uint32_t checksum;   // FNV-1a over every byte after this field
+  uint8_t  base[3];    // palette base colour
+  uint8_t  state;      // ScreenState at the time of the save (diagnostic)
+  int16_t  philo;      // canned set index when !hasLive
+  uint8_t  hasLive;
+  uint8_t  reserved;
+  uint16_t textLen;
+  char     text[kWarmTextMax];
+};
+RTC_NOINIT_ATTR static WarmState gWarmRtc;
+static uint32_t gWarmNvsChecksum = 0;  // last blob written to NVS, to skip rewrites
+
+static uint32_t warmChecksum(const WarmState& w) {
+  const uint8_t* p = (const uint8_t*)&w + offsetof(WarmState, base);
+  const uint8_t* e = (const uint8_t*)&w + sizeof(WarmState);
+  uint32_t h = 2166136261UL;
+  for (; p < e; ++p) { h ^= *p; h *= 16777619UL; }
+  return h;
+}
+
+static bool warmValid(const WarmState& w) {
+  return w.magic == kWarmMagic && w.textLen < kWarmTextMax && w.checksum == warmChecksum(w);
+}
+
+// Snapshot the content into RTC memory; with toNvs, also persist live text to flash.
+static void warmSave(uint8_t state, bool toNvs) {
+  WarmState& w = gWarmRtc;
+  memset(&w, 0, sizeof(w));
+  w.magic = kWarmMagic;
+  memcpy(w.base, gPaletteBase, sizeof(w.base));
+  w.state = state;
+  w.philo = (int16_t)currentPhilo;
+  w.hasLive = gHasLiveText ? 1 : 0;
+  if (gHasLiveText) {
+    size_t n = gLiveText.length();
+    if (n > kWarmTextMax - 1) n = kWarmTextMax - 1;
+    memcpy(w.text, gLiveText.c_str(), n);
+    w.textLen = (uint16_t)n;
+  }
+  w.checksum = warmChecksum(w);
+
+  // Flash only for live text, and only when it changed (NVS wear-levels the rest)
+  if (toNvs && w.hasLive && w.checksum != gWarmNvsChecksum) {
+    AllocScope tag(ALLOC_STORE);   // the NVS library allocates its handles
+    Preferences prefs;
+    if (prefs.begin("warm", false)) {
+      prefs.putBytes("state", &w, sizeof(w));
+      prefs.end();
+      gWarmNvsChecksum = w.checksum;
+    }
+  }
+}
+
+// Load the saved content into the live globals. Returns false on a cold start.
+static bool warmRestore() {
+  const char* source = "rtc";
+  esp_reset_reason_t why = esp_reset_reason();
+  if (why == ESP_RST_POWERON || !warmValid(gWarmRtc)) {
+    source = "nvs";
+    Preferences prefs;
+    bool ok = prefs.begin("warm", true) &&
+              prefs.getBytes("state", &gWarmRtc, sizeof(gWarmRtc)) == sizeof(gWarmRtc);
+    prefs.end();
+    if (!ok || !warmValid(gWarmRtc)) return false;
+    gWarmNvsChecksum = gWarmRtc.checksum;
+  }
+  const WarmState& w = gWarmRtc;
+  makePaletteFromBase(w.base[0], w.base[1], w.base[2]);
+  if (w.hasLive) {
+    gLiveText = textCopy(w.text);
+    gHasLiveText = true;
+  } else if (w.philo >= 0 && w.philo < kNumPhilos) {
+    currentPhilo = w.philo;
+  } else {
+    return false;
+  }
+  Serial.printf("[WARM] restoring %s content from %s (reset reason %d, saved in state %u)\n",
+                w.hasLive ? "live" : "canned", source, (int)why, w.state);
+  return true;
+}
+
+// ===== Message store =====
+// Every live message is appended to a log on the LittleFS partition so the
+// panel can bring old ones back between canned sets. RAM holds only a fixed
+// index (offset, length, tags, last shown); text is read back on demand into
+// a TextBuf. The log is only ever appended to: LittleFS spreads those block
+// writes over the partition and commits a record when the file is closed,
+// so a reset mid-write loses at most that record. Compaction copies the
+// newest half to a fresh log and deletes the old one; it is never done on
+// the message path but from loop() while a frame is held (storeMaintain),
+// once the index or the log is three-quarters full.
+#ifndef ENABLE_STORE
+#define ENABLE_STORE 1
+#endif
+#ifndef STORE_MAX
+#define STORE_MAX 1024          // index entries, 12 B of RAM each
+#endif
+#ifndef STORE_LOG_MAX
+#define STORE_LOG_MAX (320UL * 1024UL)   // leaves room to compact into on the 640 KB partition
+#endif
+#ifndef STORE_PLAY_PCT
+#define STORE_PLAY_PCT 50       // chance a stored message replaces the next canned set
+#endif
+
+#if ENABLE_STORE
+#include <LittleFS.h>
+
+static const char* const kStoreLog = "/msgs.log";
+static const char* const kStoreTmp = "/msgs.tmp";   // compaction output
+static const uint16_t kStoreMagic = 0x4D53;
+
+struct StoreRecord {      // on flash, followed by `len` bytes of text
+  uint16_t magic;
+  uint16_t len;
+  uint8_t  tags;          // 1 << Transport it arrived on
+  uint8_t  reserved[3];
+};
+
+struct StoreEntry {
+  uint32_t offset;        // of the StoreRecord in the log
+  uint16_t len;
+  uint8_t  tags;
+  uint32_t shownS;        // uptime seconds when last played, 0 = never
+};
+
+static StoreEntry gStore[STORE_MAX];
+static uint16_t   gStoreCount = 0;
+static uint32_t   gStoreLogBytes = 0;
+static uint32_t   gStoreCompactions = 0;
+static uint32_t   gStoreWriteErrors = 0;
+static uint32_t   gStoreSkipped = 0;      // messages not stored: full, or the log awaits repair
+static bool       gStoreOk = false;
+static bool       gStoreRepair = false;   // a write failed part-way; compact before appending again
+
+// Copy `n` bytes from `in` to `out` through a small stack buffer.
+static bool storeCopy(File& in, File& out, uint32_t n) {
+  uint8_t chunk[128];
+  while (n) {
+    const size_t k = n < sizeof(chunk) ? n : sizeof(chunk);
+    if (in.read(chunk, k) != k || out.write(chunk, k) != k) return false;
+    n -= k;
+  }
+  return true;
+}
+
+// Rewrite the log with entries [keepFrom, count) only.
+static bool storeCompact(uint16_t keepFrom) {
+  AllocScope tag(ALLOC_STORE);
+  const uint32_t t0 = millis();
+  File in = LittleFS.open(kStoreLog, "r");
+  File out = LittleFS.open(kStoreTmp, "w");
+  if (!in || !out) return false;
+  uint32_t off = 0;
+  uint16_t kept = 0;
+  bool ok = true;
+  for (uint16_t i = keepFrom; i < gStoreCount && ok; ++i) {
+    const StoreEntry e = gStore[i];
+    ok = in.seek(e.offset) && storeCopy(in, out, sizeof(StoreRecord) + e.len);
+    if (!ok) break;
+    gStore[kept] = e;
+    gStore[kept].offset = off;
+    kept++;
+    off += sizeof(StoreRecord) + e.len;
+  }
+  in.close();
+  out.close();
+  if (!ok) {
+    LittleFS.remove(kStoreTmp);
+    return false;
+  }
+  LittleFS.remove(kStoreLog);
+  LittleFS.rename(kStoreTmp, kStoreLog);
+  Serial.printf("[STORE] compacted %u -> %u messages in %lu ms\n", gStoreCount, kept,
+                (unsigned long)(millis() - t0));
+  gStoreCount = kept;
+  gStoreLogBytes = off;
+  gStoreCompactions++;
+  return true;
+}
+
+static void storeBegin() {
+  AllocScope tag(ALLOC_STORE);
+  if (!LittleFS.begin(true)) {
+    Serial.println("[STORE] LittleFS mount failed; message store disabled");
+    return;
+  }
+  gStoreOk = true;
+  // A compaction cut short by a reset: finish it if the old log was already gone
+  if (LittleFS.exists(kStoreTmp)) {
+    if (LittleFS.exists(kStoreLog)) LittleFS.remove(kStoreTmp);
+    else LittleFS.rename(kStoreTmp, kStoreLog);
+  }
+  File f = LittleFS.open(kStoreLog, "r");
+  if (!f) return;
+  const uint32_t size = f.size();
+  uint32_t off = 0;
+  uint32_t dropped = 0;
+  StoreRecord r;
+  while (off + sizeof(r) <= size) {
+    if (f.read((uint8_t*)&r, sizeof(r)) != sizeof(r) || r.magic != kStoreMagic ||
+        off + sizeof(r) + r.len > size) {
+      break;
+    }
+    if (gStoreCount == STORE_MAX) {
+      // More records than the index holds: forget the oldest half, as storeAppend would
+      const uint16_t half = STORE_MAX / 2;
+      memmove(gStore, gStore + half, (STORE_MAX - half) * sizeof(gStore[0]));
+      gStoreCount = STORE_MAX - half;
+      dropped += half;
+    }
+    StoreEntry& e = gStore[gStoreCount++];
+    e.offset = off;
+    e.len = r.len;
+    e.tags = r.tags;
+    e.shownS = 0;
+    off += sizeof(r) + r.len;
+    if (!f.seek(off)) break;
+  }
+  f.close();
+  gStoreLogBytes = off;
+  Serial.printf("[STORE] %u messages (%lu older dropped), %lu B of log\n", gStoreCount,
+                (unsigned long)dropped, (unsigned long)size);
+  // Trailing garbage or dropped records: rewrite a clean log of the indexed ones
+  if (off < size || dropped) storeCompact(0);
+}
+
+static void storeAppend(const char* text, size_t len, uint8_t tags) {
+  if (!gStoreOk || !len) return;
+  AllocScope tag(ALLOC_STORE);
+  if (gStoreRepair || gStoreCount >= STORE_MAX ||
+      gStoreLogBytes + sizeof(StoreRecord) + len > STORE_LOG_MAX) {
+    gStoreSkipped++;   // storeMaintain makes room before this normally happens
+    return;
+  }
+  File f = LittleFS.open(kStoreLog, "a");
+  if (!f) return;
+  const StoreRecord r = { kStoreMagic, (uint16_t)len, tags, {0, 0, 0} };
+  const bool ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r) &&
+                  f.write((const uint8_t*)text, len) == len;
+  f.close();
+  if (!ok) {
+    // Flash full or failing: storeMaintain drops whatever part of the record made it
+    gStoreWriteErrors++;
+    gStoreRepair = true;
+    return;
+  }
+  StoreEntry& e = gStore[gStoreCount++];
+  e.offset = gStoreLogBytes;
+  e.len = (uint16_t)len;
+  e.tags = tags;
+  e.shownS = 0;
+  gStoreLogBytes += sizeof(r) + len;
+}
+
+// Called from loop() while a frame is held in WAIT_60S: compacts once the
+// index or the log is three-quarters full, so storeAppend always has room,
+// and repairs the log after a failed write. Failures retry once a minute.
+static void storeMaintain() {
+  static uint32_t lastTryMs = 0;
+  if (!gStoreOk) return;
+  const bool full = gStoreCount >= STORE_MAX * 3 / 4 || gStoreLogBytes >= STORE_LOG_MAX * 3 / 4;
+  if (!gStoreRepair && !full) return;
+  if (lastTryMs && millis() - lastTryMs < 60000UL) return;
+  lastTryMs = millis() | 1UL;
+  if (storeCompact(gStoreRepair ? 0 : gStoreCount / 2)) {
+    gStoreRepair = false;
+    lastTryMs = 0;
+  }
+}
+
+// Load a stored message for replay: the least recently shown of a few random
+// entries, so the pick stays O(1) however large the store is.
+static bool storePick(TextRef& out) {
+  if (!gStoreOk || !gStoreCount) return false;
+  AllocScope tag(ALLOC_STORE);
+  uint16_t best = (uint16_t)random(gStoreCount);
+  for (uint8_t k = 1; k < 4; ++k) {
+    const uint16_t i = (uint16_t)random(gStoreCount);
+    if (gStore[i].shownS < gStore[best].shownS) best = i;
+  }
+  StoreEntry& e = gStore[best];
+  TextRef t = textAlloc();
+  if (!t) return false;
+  File f = LittleFS.open(kStoreLog, "r");
+  if (!f || !f.seek(e.offset + sizeof(StoreRecord))) return false;
+  char chunk[128];
+  for (uint32_t left = e.len; left; ) {
+    const size_t k = left < sizeof(chunk) ? left : sizeof(chunk);
+    if (f.read((uint8_t*)chunk, k) != k) return false;
+    t.append(chunk, k);
+    left -= k;
+  }
+  f.close();
+  e.shownS = millis() / 1000UL | 1UL;
+  out = std::move(t);
+  return true;
+}
+
+static void printStore(Print& out) {
+  if (!gStoreOk) {
+    out.println("[STORE] not mounted");
+    return;
+  }
+  uint16_t byVia[3] = {0, 0, 0}, shown = 0;
+  for (uint16_t i = 0; i < gStoreCount; ++i) {
+    for (uint8_t v = 0; v < 3; ++v) if (gStore[i].tags & (1u << v)) byVia[v]++;
+    if (gStore[i].shownS) shown++;
+  }
+  out.printf("[STORE] messages=%u/%u (usb=%u ble=%u http=%u) replayed=%u log=%lu/%lu B\n",
+             gStoreCount, (unsigned)STORE_MAX, byVia[VIA_USB], byVia[VIA_BLE], byVia[VIA_HTTP], shown,
+             (unsigned long)gStoreLogBytes, (unsigned long)STORE_LOG_MAX);
+  out.printf("[STORE] fs used=%lu/%lu B compactions=%lu write_errors=%lu skipped=%lu index=%u B\n",
+             (unsigned long)LittleFS.usedBytes(), (unsigned long)LittleFS.totalBytes(),
+             (unsigned long)gStoreCompactions, (unsigned long)gStoreWriteErrors,
+             (unsigned long)gStoreSkipped, (unsigned)sizeof(gStore));
+}
+
+static void clearStore(Print& out) {
+  if (gStoreOk) LittleFS.remove(kStoreLog);
+  gStoreCount = 0;
+  gStoreLogBytes = 0;
+  gStoreRepair = false;
+  out.println("[STORE] cleared");
+}
+#endif
+
+// ===== Flash assets =====
+// Fonts, bitmaps and blobs packed by src/pack_assets.py into the "assets"
+// partition (partitions.csv) and mapped into the data address space through
+// the flash MMU at boot. Nothing is copied: a font is a GFXfont whose glyph
+// table and bitmap point into the mapping, a bitmap is handed to
+// drawRGBBitmap() as is. A font named "text" becomes the message font and
+// bitmaps "thinking"/"thinking_on" replace the thinking label. Reads go
+// through the 32 KB flash cache; `/bench` prints what a cold and a warm read
+// cost against the same asset in RAM.
+#ifndef ENABLE_ASSETS
+#define ENABLE_ASSETS 1
+#endif
+
+#if ENABLE_ASSETS
+#include <esp_partition.h>
+
+static const uint32_t kAssetMagic = 0x31415050;   // "PPA1"
+static const esp_partition_subtype_t kAssetSubtype = (esp_partition_subtype_t)0x40;
+
+enum AssetType : uint8_t { ASSET_BLOB, ASSET_BITMAP565, ASSET_FONT };
+
+// Layout shared with src/pack_assets.py; all offsets are from the partition start.
+struct AssetHeader {
+  uint32_t magic;
+  uint16_t count;
+  uint16_t reserved;
+  uint32_t size;         // bytes used, header included
+};
+struct AssetEntry {
+  char     name[16];
+  uint8_t  type;         // AssetType
+  uint8_t  reserved;
+  uint16_t w, h;         // bitmaps: pixels; fonts: first/last char
+  uint16_t reserved2;
+  uint32_t offset;
+  uint32_t size;
+};
+struct AssetFontHeader { // followed by the GFXglyph table and the glyph bitmaps
+  uint16_t first, last;
+  uint8_t  yAdvance;
+  uint8_t  reserved[3];
+};
+
+static const uint8_t*    gAssetBase = nullptr;   // start of the mapping
+static const AssetHeader* gAssetHdr = nullptr;
+static uint32_t          gAssetPartSize = 0;
+
+static void assetTextFont();
+
+static bool assetsBegin() {
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, kAssetSubtype, "assets");
+  if (!part) return false;
+  const void* p = nullptr;
+  spi_flash_mmap_handle_t handle;   // kept mapped for the life of the firmware
+  if (esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &p, &handle) != ESP_OK) return false;
+  const AssetHeader* h = (const AssetHeader*)p;
+  if (h->magic != kAssetMagic || h->size > part->size ||
+      sizeof(AssetHeader) + (uint32_t)h->count * sizeof(AssetEntry) > h->size) {
+    Serial.println("[ASSET] partition is empty or not a pack_assets.py image");
+    return false;
+  }
+  gAssetBase = (const uint8_t*)p;
+  gAssetHdr = h;
+  gAssetPartSize = part->size;
+  Serial.printf("[ASSET] %u assets, %lu B mapped at %p\n", h->count, (unsigned long)h->size, p);
+  assetTextFont();
+  return true;
+}
+
+static const AssetEntry* assetTable() {
+  return (const AssetEntry*)(gAssetBase + sizeof(AssetHeader));
+}
+
+static const AssetEntry* assetFind(const char* name, AssetType type) {
+  if (!gAssetHdr) return nullptr;
+  const AssetEntry* e = assetTable();
+  for (uint16_t i = 0; i < gAssetHdr->count; ++i, ++e) {
+    if (e->type == type && !strncmp(e->name, name, sizeof(e->name))) return e;
+  }
+  return nullptr;
+}
+
+// A GFXfont over the mapping; only the 12-byte descriptor lives in RAM.
+static bool assetFont(const AssetEntry* e, GFXfont& font) {
+  if (!e || e->type != ASSET_FONT) return false;
+  const uint8_t* p = gAssetBase + e->offset;
+  const AssetFontHeader* fh = (const AssetFontHeader*)p;
+  const uint32_t glyphBytes = (uint32_t)(fh->last - fh->first + 1) * sizeof(GFXglyph);
+  font.glyph    = (GFXglyph*)(p + sizeof(AssetFontHeader));
+  font.bitmap   = (uint8_t*)(p + sizeof(AssetFontHeader) + glyphBytes);
+  font.first    = fh->first;
+  font.last     = fh->last;
+  font.yAdvance = fh->yAdvance;
+  return true;
+}
+
+// A "text" font asset replaces the built-in 5x7 in the message renderers if
+// it fits their 10 px rows.
+static void assetTextFont() {
+  static GFXfont font;
+  if (!assetFont(assetFind("text", ASSET_FONT), font)) return;
+  if (font.yAdvance > 10) {
+    Serial.printf("[ASSET] text font is %u px tall, rows are 10; keeping the built-in font\n", font.yAdvance);
+    return;
+  }
+  gTextFont = &font;
+  Serial.println("[ASSET] message text drawn with the mapped \"text\" font");
+}
+
+// Blit an RGB565 asset straight from flash; false if there is no such bitmap.
+static bool drawAssetBitmap(const char* name, int16_t x, int16_t y) {
+  const AssetEntry* e = assetFind(name, ASSET_BITMAP565);
+  if (!e) return false;
+  gfx->drawRGBBitmap(x, y, (const uint16_t*)(gAssetBase + e->offset), (int16_t)e->w, (int16_t)e->h);
+  return true;
+}
+
+static void printAssets(Print& out) {
+  if (!gAssetHdr) {
+    out.println("[ASSET] none (flash an image built by src/pack_assets.py)");
+    return;
+  }
+  static const char* const kTypes[] = { "blob", "bitmap", "font" };
+  out.printf("[ASSET] %u assets, %lu/%lu B\n", gAssetHdr->count, (unsigned long)gAssetHdr->size,
+             (unsigned long)gAssetPartSize);
+  const AssetEntry* e = assetTable();
+  for (uint16_t i = 0; i < gAssetHdr->count; ++i, ++e) {
+    out.printf("[ASSET]   %-16.16s %-6s %ux%u %lu B @0x%lx\n", e->name, e->type < 3 ? kTypes[e->type] : "?",
+               e->w, e->h, (unsigned long)e->size, (unsigned long)e->offset);
+  }
+}
+#endif
+
+// Render "thinking" at bottom with optional flashing cursor
+void renderThining(bool cursorOn) {
+  CycleScope prof(gProf.section[PROF_THINKING]);
+  TlScope tl(TL_THINKING);
+  AllocScope tag(ALLOC_RENDER);
+  const int textH = 8; // default font height
+  const int y = PANEL_RES_Y - textH;
+  gfx->fillRect(0, y, gfx->width(), textH, 0); // clear bottom strip across both panels
+  #if ENABLE_ASSETS
+  // A "thinking" sprite in the asset partition replaces the label
+  if (cursorOn && drawAssetBitmap("thinking_on", 0, (int16_t)y)) return;
+  if (drawAssetBitmap("thinking", 0, (int16_t)y)) return;
+  #endif
+  gfx->setCursor(0, y);
+  gfx->setTextColor(color565(255, 255, 0)); // yellow
+  gfx->print("thinking");
+  if (cursorOn) gfx->print("_");
+}
+
+// ===== Panel diagnostics =====
+// `/panel` reports what the HUB75 DMA driver settled on: its calculated
+// refresh, the refresh actually achieved, per-frame DMA time, bitplanes and
+// the DMA memory begin() took. The achieved rate is counted in hardware: PCNT
+// taps the top row-address line, which rises exactly once per full scan.
+// `/panel sweep` reboots through each I2S clock speed, measuring each one, and
+// prints a table at the end; watch the panel for ghosting while it runs.
+// Colour depth is fixed at compile time by the driver (PIXEL_COLOR_DEPTH_BITS),
+// so depths are compared across builds: `/panel` files this build's figures
+// in NVS under its PANEL_PROFILE and prints them next to the other profile's.
+#include <driver/pcnt.h>
+#include <esp_rom_gpio.h>
+#include <soc/gpio_periph.h>
+#include <soc/gpio_sig_map.h>
+
+#ifndef PANEL_SWEEP_SETTLE_MS
+#define PANEL_SWEEP_SETTLE_MS 3000UL   // time to eyeball each speed before measuring
+#endif
+#ifdef PIXEL_COLOR_DEPTH_BITS
+static const uint8_t kPanelDepthBits = PIXEL_COLOR_DEPTH_BITS;
+#else
+static const uint8_t kPanelDepthBits = 8;   // driver default
+#endif
+
+static const HUB75_I2S_CFG::clk_speed kPanelSpeed = HUB75_I2S_CFG::HZ_20M;
+#if PANEL_PROFILE == PANEL_PROFILE_TEXT
+static const uint16_t kPanelMinRefresh = 480;
+static const char* const kPanelProfile = "text";
+#else
+static const uint16_t kPanelMinRefresh = 240;
+static const char* const kPanelProfile = "image";
+#endif
+
+// Rows per scan is half the panel height; its highest address bit toggles once per frame.
+static const uint8_t kScanTopAddrPin = (PANEL_RES_Y / 2 > 16) ? HUB75_E_PIN
+                                     : (PANEL_RES_Y / 2 > 8)  ? HUB75_D_PIN : HUB75_C_PIN;
+
+struct PanelInfo {
+  uint32_t i2sHz;
+  uint32_t dmaBytes;   // DMA-capable heap begin() consumed (buffers + descriptors)
+  uint32_t beginUs;
+};
+static PanelInfo gPanelInfo;
+
+// Rising edges per second on the top address line, i.e. full scans per second.
+static uint32_t measurePanelRefreshHz(uint32_t windowMs) {
+  pcnt_config_t pc = {};
+  pc.pulse_gpio_num = PCNT_PIN_NOT_USED;
+  pc.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+  pc.channel        = PCNT_CHANNEL_0;
+  pc.unit           = PCNT_UNIT_0;
+  pc.pos_mode       = PCNT_COUNT_INC;
+  pc.neg_mode       = PCNT_COUNT_DIS;
+  pc.lctrl_mode     = PCNT_MODE_KEEP;
+  pc.hctrl_mode     = PCNT_MODE_KEEP;
+  pc.counter_h_lim  = INT16_MAX;
+  pc.counter_l_lim  = 0;
+  if (pcnt_unit_config(&pc) != ESP_OK) return 0;
+  // Enable the pad's input path only: pcnt_set_pin() would also switch the
+  // pin to input and cut the I2S output driving the panel.
+  PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[kScanTopAddrPin]);
+  esp_rom_gpio_connect_in_signal(kScanTopAddrPin, PCNT_SIG_CH0_IN0_IDX, false);
+
+  pcnt_counter_pause(PCNT_UNIT_0);
+  pcnt_counter_clear(PCNT_UNIT_0);
+  uint32_t t0 = micros();
+  pcnt_counter_resume(PCNT_UNIT_0);
+  delay(windowMs);
+  int16_t edges = 0;
+  pcnt_get_counter_value(PCNT_UNIT_0, &edges);
+  uint32_t dt = micros() - t0;
+  pcnt_counter_pause(PCNT_UNIT_0);
+  return dt ? (uint32_t)((uint64_t)edges * 1000000ULL / dt) : 0;
+}
+
+// What one profile measured, kept in NVS so the other build can compare.
+struct PanelProfileFigures {
+  uint8_t  depthBits;
+  uint32_t i2sHz;
+  uint32_t dmaBytes;
+  uint32_t measuredHz;
+};
+
+static void printPanelProfiles(uint32_t hz, Print& out) {
+  const PanelProfileFigures mine = { kPanelDepthBits, gPanelInfo.i2sHz, gPanelInfo.dmaBytes, hz };
+  PanelProfileFigures other;
+  const char* otherName = (PANEL_PROFILE == PANEL_PROFILE_TEXT) ? "image" : "text";
+  Preferences prefs;
+  prefs.begin("panel", false);
+  prefs.putBytes(kPanelProfile, &mine, sizeof(mine));
+  const bool have = prefs.getBytes(otherName, &other, sizeof(other)) == sizeof(other);
+  prefs.end();
+  if (!have) {
+    out.printf("[PANEL] profile=%s; flash the %s profile and run /panel there to compare\n",
+               kPanelProfile, otherName);
+    return;
+  }
+  // Report as text vs image whichever build we are on.
+  const bool text = PANEL_PROFILE == PANEL_PROFILE_TEXT;
+  const PanelProfileFigures& t = text ? mine : other;
+  const PanelProfileFigures& im = text ? other : mine;
+  out.printf("[PANEL] profile=%s  text: depth=%u dma=%lu B %lu Hz  image: depth=%u dma=%lu B %lu Hz\n",
+             kPanelProfile, t.depthBits, (unsigned long)t.dmaBytes, (unsigned long)t.measuredHz,
+             im.depthBits, (unsigned long)im.dmaBytes, (unsigned long)im.measuredHz);
+  out.printf("[PANEL] text saves %ld B of DMA RAM, refresh x%lu.%02lu%s\n",
+             (long)im.dmaBytes - (long)t.dmaBytes,
+             (unsigned long)(im.measuredHz ? t.measuredHz / im.measuredHz : 0),
+             (unsigned long)(im.measuredHz ? t.measuredHz * 100UL / im.measuredHz % 100 : 0),
+             t.i2sHz == im.i2sHz ? "" : " (different i2s speeds)");
+}
+
+static void printPanelReport(Print& out) {
+  uint32_t hz = measurePanelRefreshHz(1000);
+  out.printf("[PANEL] %dx%d (%d x %dx%d, 1/%d scan) i2s=%lu MHz depth=%u bitplanes min_refresh=%u Hz\n",
+             PANEL_RES_X * PANEL_CHAIN, PANEL_RES_Y, PANEL_CHAIN, PANEL_RES_X, PANEL_RES_Y,
+             PANEL_RES_Y / 2, (unsigned long)(gPanelInfo.i2sHz / 1000000UL), kPanelDepthBits,
+             kPanelMinRefresh);
+  out.printf("[PANEL] refresh calc=%d Hz measured=%lu Hz frame=%lu us (%lu i2s clocks/frame)\n",
+             dma_display->calculated_refresh_rate, (unsigned long)hz,
+             (unsigned long)(hz ? 1000000UL / hz : 0), (unsigned long)(hz ? gPanelInfo.i2sHz / hz : 0));
+  out.printf("[PANEL] dma=%lu bytes (buffers+descriptors) dma_free=%lu begin=%lu us\n",
+             (unsigned long)gPanelInfo.dmaBytes,
+             (unsigned long)heap_caps_get_free_size(MALLOC_CAP_DMA), (unsigned long)gPanelInfo.beginUs);
+  printPanelProfiles(hz, out);
+}
+
+// Sweep progress lives in RTC memory so it survives the software resets
+// between steps. Any other reset (a panic at a speed that is too fast, say)
+// ends the sweep.
+static const HUB75_I2S_CFG::clk_speed kSweepSpeeds[] = {
+  HUB75_I2S_CFG::HZ_8M, HUB75_I2S_CFG::HZ_10M, HUB75_I2S_CFG::HZ_15M, HUB75_I2S_CFG::HZ_20M,
+};
+static const uint8_t  kSweepSteps   = sizeof(kSweepSpeeds) / sizeof(kSweepSpeeds[0]);
+static const uint32_t kSweepRunning = 0x50575352; // "RSWP"
+static const uint32_t kSweepDone    = 0x50575344; // "DSWP"
+
+struct PanelSweepRow {
+  uint32_t calcHz;
+  uint32_t measuredHz;
+  uint32_t dmaBytes;
+};
+struct PanelSweep {
+  uint32_t magic;
+  uint8_t  next;
+  PanelSweepRow row[kSweepSteps];
+};
+RTC_NOINIT_ATTR static PanelSweep gSweep;
+
+static bool panelSweepRunning() {
+  return gSweep.magic == kSweepRunning && gSweep.next < kSweepSteps &&
+         esp_reset_reason() == ESP_RST_SW;
+}
+
+static HUB75_I2S_CFG::clk_speed panelBootSpeed() {
+  return panelSweepRunning() ? kSweepSpeeds[gSweep.next] : kPanelSpeed;
+}
+
+static void printPanelSweep(Print& out) {
+  if (gSweep.magic != kSweepDone || gSweep.next != kSweepSteps) return;
+  out.println("[PANEL] sweep: i2s_MHz calc_Hz measured_Hz frame_us dma_bytes");
+  for (uint8_t i = 0; i < kSweepSteps; ++i) {
+    const PanelSweepRow& r = gSweep.row[i];
+    out.printf("[PANEL]   %7lu %7lu %11lu %8lu %9lu\n", (unsigned long)(kSweepSpeeds[i] / 1000000UL),
+               (unsigned long)r.calcHz, (unsigned long)r.measuredHz,
+               (unsigned long)(r.measuredHz ? 1000000UL / r.measuredHz : 0), (unsigned long)r.dmaBytes);
+  }
+}
+
+static void startPanelSweep(Print& out) {
+  gSweep.magic = kSweepRunning;
+  gSweep.next = 0;
+  out.printf("[PANEL] sweeping %u I2S speeds, %lu ms each; rebooting\n", kSweepSteps,
+             (unsigned long)PANEL_SWEEP_SETTLE_MS);
+  delay(200); // let the reply drain over USB/BLE
+  ESP.restart();
+}
+
+// Called from setup() once the first frame is up at the speed under test.
+// Does not return while steps remain.
+static void panelSweepStep() {
+  delay(PANEL_SWEEP_SETTLE_MS);
+  PanelSweepRow& r = gSweep.row[gSweep.next];
+  r.calcHz = (uint32_t)dma_display->calculated_refresh_rate;
+  r.measuredHz = measurePanelRefreshHz(1000);
+  r.dmaBytes = gPanelInfo.dmaBytes;
+  Serial.printf("[PANEL] sweep %u/%u: i2s=%lu MHz measured=%lu Hz\n", gSweep.next + 1, kSweepSteps,
+                (unsigned long)(gPanelInfo.i2sHz / 1000000UL), (unsigned long)r.measuredHz);
+  if (++gSweep.next < kSweepSteps) ESP.restart();
+  gSweep.magic = kSweepDone;
+  printPanelSweep(Serial);
+  ESP.restart(); // come back up at the configured speed
+}
+
+// ===== Minimal panel config (pins) =====
+static void initPanel(HUB75_I2S_CFG::clk_speed speed) {
   HUB75_I2S_CFG cfg(PANEL_RES_X, PANEL_RES_Y, PANEL_CHAIN);
-  cfg.i2sspeed        = HUB75_I2S_CFG::HZ_20M;   // or HZ_40M if stable
-  cfg.min_refresh_rate= 240;                     // bump target refresh
+  cfg.i2sspeed        = speed;
+  cfg.min_refresh_rate= kPanelMinRefresh;        // bump target refresh
   cfg.clkphase        = HUB75_CLK_PHASE;         // toggle via build flag if rows are shifted
   cfg.driver          = HUB75_DRIVER;
 
@@ -456,156 +2624,927 @@ static void initPanel() {
   cfg.gpio.d = HUB75_D_PIN;
   cfg.gpio.e = HUB75_E_PIN;
 
+  #if STATIC_ALLOC
+  alignas(MatrixPanel_I2S_DMA) static uint8_t storage[sizeof(MatrixPanel_I2S_DMA)];
+  dma_display = new (storage) MatrixPanel_I2S_DMA(cfg);
+  #else
   dma_display = new MatrixPanel_I2S_DMA(cfg);
+  #endif
+  uint32_t dmaBefore = heap_caps_get_free_size(MALLOC_CAP_DMA);
+  uint32_t t0 = micros();
   dma_display->begin();
+  gPanelInfo.beginUs = micros() - t0;
+  gPanelInfo.dmaBytes = dmaBefore - heap_caps_get_free_size(MALLOC_CAP_DMA);
+  gPanelInfo.i2sHz = (uint32_t)speed;
 }
 
-void setup() {
-  Serial.begin(115200);
-  randomSeed((uint32_t)micros());
-
-  initPanel();
-  dma_display->setBrightness8(kTargetBrightness);
-  dma_display->fillScreen(0);
-
-  randomizePalette();
-
-  buildCannedCombined();
-
-  // Pick a random starting set and draw
-  currentPhilo = random(kNumPhilos);
-  drawSixLines();
-
-  // Bluetooth BLE (NimBLE UART / NUS)
-  #if ENABLE_BT
-  initBLE();
-  if (Serial) Serial.println("[BLE] setup complete; scanning from a phone or Mac should show 'MatrixPanel'.");
-  #endif
+// ===== Screen state machine =====
+enum ScreenState { STATE_WAIT_60S, STATE_DISSOLVING, STATE_POST_DISSOLVE_PAUSE,
+                   STATE_THINING, STATE_TYPEWRITER, STATE_DONE, STATE_COUNT };
 
-  // --- Wi-Fi station bring-up ---
-  #if ENABLE_WIFI
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASS);
-  unsigned long wifiStart = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - wifiStart < 15000UL) {
-    delay(250);
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.print("ESP32 IP: ");
-    Serial.println(WiFi.localIP());
-    // Show IP on the LED panel for 5 seconds
-    dma_display->fillScreen(0);
-    dma_display->setCursor(0, 0);
-    dma_display->setTextColor(dma_display->color565(255, 255, 255));
-    dma_display->print("IP: ");
-    dma_display->println(WiFi.localIP());
-    delay(5000);
-
-    // Restore initial display
-    drawSixLines();
-  } else {
-    Serial.println("Wi-Fi not connected (continuing; BT will still work).");
-  }
-  #endif
+struct ScreenMachine {
+  ScreenState state = STATE_WAIT_60S;
+  uint32_t tMark = 0;           // phase start time (gClock ms)
 
-// --- HTTP endpoint ---
-  #if ENABLE_HTTP_SERVER
-  server.on("/post", HTTP_POST, handlePost);
-  server.begin();
+  // Typewriter progress
+  size_t   twIdx = 0;           // number of characters revealed
+  uint32_t twStart = 0;
+  static const uint16_t twDelayMs = 30; // per-character delay (faster feels better when wrapping)
+
+  int8_t   thinkCursor = -1;    // cursor state last drawn; -1 forces a redraw
+  uint32_t wokeUs = 0;          // wake stamp of the message awaiting its first draw
+  uint32_t ipOverlayUntil = 0;  // gClock ms deadline while the IP overlay is up
+  Dissolve dissolve;            // in progress while in STATE_DISSOLVING
+  #if PALETTE_CYCLE_MS
+  uint32_t cycleMark = 0;       // last palette rotation (gClock ms)
   #endif
-}
 
-void loop() {
-  #if ENABLE_HTTP_SERVER
-  server.handleClient();
-  #endif
-  processUSB();
-  #if ENABLE_BT
-  processBluetooth();
-  #endif
+  // Simulated runs: no logging, persistence or brightness changes
+  bool     sim = false;
+  uint32_t cycles = 0;          // completed DONE -> WAIT transitions
+  uint32_t liveShown = 0;       // live messages typed out in full
+  uint32_t stateMs[STATE_COUNT] = {0}; // time spent per state
 
-  enum ScreenState { STATE_WAIT_60S, STATE_DISSOLVING, STATE_POST_DISSOLVE_PAUSE,
-                     STATE_THINING, STATE_TYPEWRITER, STATE_DONE };
-  static ScreenState state = STATE_WAIT_60S;
-  static unsigned long tMark = millis();  // phase start time
+  void start(ScreenState s) { state = s; tMark = gClock->nowMs(); }
+  void step(bool newLive);
+};
 
-  // Typewriter progress
-  static size_t twIdx = 0;    // number of characters revealed
-  static unsigned long twLast = 0;
-  const uint16_t twDelayMs = 30; // per-character delay (faster feels better when wrapping)
+static void traceFinish();
 
-  // Check Bluetooth; if new text, start dissolve immediately
-  if (kNewLivePending) {
-    kNewLivePending = false;
-    tMark = millis();
+void ScreenMachine::step(bool newLive) {
+  if (newLive) {
+    dissolve.end();   // start over for the new message
+    tMark = gClock->nowMs();
     state = STATE_DISSOLVING;
+    if (!sim) warmSave(state, true);
   }
+  const ScreenState entered = state;
+  const uint32_t t0 = gClock->nowMs();
+  if (!sim) gProf.state = (uint8_t)state;
 
   switch (state) {
     case STATE_WAIT_60S: {
-      if (millis() - tMark >= 60000UL) {
+      if (ipOverlayUntil && (int32_t)(gClock->nowMs() - ipOverlayUntil) >= 0) {
+        ipOverlayUntil = 0;
+        drawSixLines(); // restore the message under the IP overlay
+      }
+      if (gClock->nowMs() - tMark >= 60000UL) {
         state = STATE_DISSOLVING; // run a ~2s dissolve next
+      } else {
+        uint32_t until = ipOverlayUntil ? ipOverlayUntil : tMark + 60000UL;
+        #if PALETTE_CYCLE_MS
+        // Rotate the gradient in place; the glyphs stay as drawn
+        if (!sim && !ipOverlayUntil) {
+          if (gClock->nowMs() - cycleMark >= PALETTE_CYCLE_MS) {
+            cycleMark = gClock->nowMs();
+            cyclePalette();
+          }
+          if ((int32_t)(cycleMark + PALETTE_CYCLE_MS - until) < 0) until = cycleMark + PALETTE_CYCLE_MS;
+        }
+        #endif
+        idleWait(until);  // static frame: DMA refreshes, CPU sleeps
       }
     } break;
 
     case STATE_DISSOLVING: {
-      Serial.println("[STATE] DISSOLVING");
-      // Chunky, obvious dissolve using 4x4 tiles over ~1.5s across full chained width
-      dissolveClearBlocks((uint16_t)dma_display->width(), (uint16_t)dma_display->height(), 1500, 4);
-      tMark = millis();
-      state = STATE_POST_DISSOLVE_PAUSE;            // 1s pause
+      if (!dissolve.active()) {
+        if (!sim) Serial.println("[STATE] DISSOLVING");
+        if (!sim) traceMark(TR_DISSOLVE);
+        ipOverlayUntil = 0;
+        if (wokeUs) { noteWakeToRender(wokeUs); wokeUs = 0; }
+        // Chunky, obvious dissolve over ~1.5s across full chained width; 4x4 tiles,
+        // coarser when the governor has had to drop quality
+        dissolve.begin((uint16_t)gfx->width(), (uint16_t)gfx->height(), 1500,
+                       gGovernor.tileSize(4), sim ? 1 : 0);
+      }
+      // One frame per loop() so the transports are served during the dissolve
+      gGovernor.beginFrame();
+      const bool cleared = dissolve.step();
+      gGovernor.endFrame();
+      if (cleared) {
+        tMark = gClock->nowMs();
+        state = STATE_POST_DISSOLVE_PAUSE;          // 1s pause
+      } else {
+        gGovernor.pace();
+      }
     } break;
 
     case STATE_POST_DISSOLVE_PAUSE: {
-      if (millis() - tMark >= 1000UL) {
-        tMark = millis();
+      if (gClock->nowMs() - tMark >= 1000UL) {
+        tMark = gClock->nowMs();
+        thinkCursor = -1;
         state = STATE_THINING;
+        if (!sim) traceMark(TR_THINKING);
+      } else {
+        idleWait(tMark + 1000UL);
       }
     } break;
 
-    
-
     case STATE_THINING: {
-      // Blink cursor every ~500ms
-      bool cursorOn = ((millis() / 500UL) % 2) == 0;
-      renderThining(cursorOn);
+      gGovernor.beginFrame();
+      // Blink cursor every ~500ms; only touch the panel when it flips
+      bool cursorOn = ((gClock->nowMs() / 500UL) % 2) == 0;
+      if ((int8_t)cursorOn != thinkCursor) {
+        renderThining(cursorOn);
+        thinkCursor = (int8_t)cursorOn;
+      }
 
       // After 10s, begin typewriter reveal of current text
-      if (millis() - tMark >= 10000UL) {
-        dma_display->setBrightness8(kTargetBrightness);
-        dma_display->fillScreen(0);
-        twIdx = 0; twLast = 0;
+      if (gClock->nowMs() - tMark >= 10000UL) {
+        if (!sim) dma_display->setBrightness8(kTargetBrightness);
+        gfx->fillScreen(0);
+        twIdx = 0; twStart = gClock->nowMs();
         randomizePalette();
         state = STATE_TYPEWRITER;
       }
-      delay(30); // gentle pace for redraws
+      gGovernor.endFrame();
+      gGovernor.pace();
     } break;
 
     case STATE_TYPEWRITER: {
-      if (millis() - twLast >= twDelayMs) {
-        twLast = millis();
-        const String &src = gHasLiveText ? gLiveText : gCannedText[currentPhilo];
-        if (twIdx < src.length()) {
-          // Redraw substring [0..twIdx] with per-line gradient
-          drawWrappedGradient(src, (int32_t)(twIdx + 1));
-          twIdx++;
+      gGovernor.beginFrame();
+      const char* src = displayText();
+      const size_t total = visibleLength(src);
+      // Reveal by elapsed time so a slow frame catches up instead of stretching the cadence
+      size_t due = (gClock->nowMs() - twStart) / twDelayMs + 1;
+      if (due > total) due = total;
+      if (due > twIdx) {
+        if (gGovernor.quality == 0) {
+          drawWrappedGradient(src, (int32_t)due);            // full redraw with per-line gradient
         } else {
-          state = STATE_DONE; // finished
+          drawGradientSpan(src, (int32_t)twIdx, (int32_t)due); // append only the new glyphs
+        }
+        if (!sim && twIdx == 0) traceMark(TR_FIRST_GLYPH);
+        twIdx = due;
+      }
+      gGovernor.endFrame();
+      if (twIdx >= total) {
+        if (!sim) {
+          AllocScope tag(ALLOC_LOG);
+          Serial.printf("[FPS] avg=%lu us budget=%lu us overruns=%lu quality=%u\n",
+                        (unsigned long)gGovernor.avgCostUs, (unsigned long)gGovernor.budgetUs,
+                        (unsigned long)gGovernor.overruns, gGovernor.quality);
         }
+        if (gHasLiveText) liveShown++;
+        if (!sim) traceFinish();
+        tMark = gClock->nowMs();
+        state = STATE_DONE; // finished
+        if (!sim) warmSave(state, false);
+      } else {
+        gGovernor.pace();
       }
-      delay(10);
     } break;
 
     case STATE_DONE: {
-      // Hold briefly, then choose a new canned set and wait again
-      delay(2000);
+      // Hold briefly (idle), then choose a new canned set and wait again
+      if (gClock->nowMs() - tMark < 2000UL) {
+        idleWait(tMark + 2000UL);
+        break;
+      }
       int prev = currentPhilo;
       if (kNumPhilos > 1) {
         do { currentPhilo = random(kNumPhilos); } while (currentPhilo == prev);
       }
       gHasLiveText = false; // return to canned cycle after showing live once
-      tMark = millis();
+      gLiveText.reset();
+      #if ENABLE_STORE
+      // Now and then bring back a stored message instead of the canned set
+      if (!sim && (int)random(100) < STORE_PLAY_PCT && storePick(gLiveText)) gHasLiveText = true;
+      #endif
+      tMark = gClock->nowMs();
       state = STATE_WAIT_60S;
+      cycles++;
     } break;
+
+    default: break;
+  }
+  stateMs[entered] += gClock->nowMs() - t0;
+  if (!sim && state != entered) heapSample();
+}
+
+static ScreenMachine gScreen;
+
+// Stamp completion and report the trace.
+static void traceFinish() {
+  if (!gActiveTrace) return;
+  traceMark(TR_DONE);
+  reportTrace(*gActiveTrace);
+  gActiveTrace = nullptr;
+}
+
+static const char* const kStateNames[STATE_COUNT] = {
+  "wait", "dissolve", "pause", "thinking", "typewriter", "done"
+};
+
+static void logStall(const StallRecord& r, Print& out) {
+  AllocScope tag(ALLOC_LOG);
+  out.printf("[STALL] t=%lu ms: %lu us busy, worst section %s %lu us (state %s)\n",
+             (unsigned long)r.atMs, (unsigned long)r.loopUs, kSectionNames[r.section],
+             (unsigned long)r.sectionUs, r.state < STATE_COUNT ? kStateNames[r.state] : "?");
+}
+
+// `/stalls` report: totals, per-section worst case, then the ring oldest first.
+static void printStalls(Print& out) {
+  const LoopMonitor& m = gLoopMon;
+  out.printf("[STALL] iterations=%lu stalls=%lu ble_cb_stalls=%lu max_loop=%lu us threshold=%u ms\n",
+             (unsigned long)m.iterations, (unsigned long)m.stalls, (unsigned long)m.cbStalls,
+             (unsigned long)m.maxLoopUs, (unsigned)STALL_THRESHOLD_MS);
+  for (uint8_t i = 0; i < SEC_COUNT; ++i) {
+    out.printf("[STALL]   worst %-6s %lu us\n", kSectionNames[i], (unsigned long)m.worstUs[i]);
+  }
+  for (uint8_t i = 0; i < m.ringCount; ++i) {
+    uint8_t at = (uint8_t)((m.ringHead + LoopMonitor::kRing - m.ringCount + i) % LoopMonitor::kRing);
+    logStall(m.ring[at], out);
+  }
+}
+
+static void printHistLine(const char* kind, const char* name, const CycleHist& h, Print& out) {
+  if (!h.n) return;
+  const uint32_t mhz = ESP.getCpuFreqMHz();
+  out.printf("[HIST] %s/%s n=%lu mean=%lu p50=%lu p90=%lu p99=%lu max=%lu us\n", kind, name,
+             (unsigned long)h.n, (unsigned long)(h.sumC / h.n / mhz),
+             (unsigned long)(h.percentile(500) / mhz), (unsigned long)(h.percentile(900) / mhz),
+             (unsigned long)(h.percentile(990) / mhz), (unsigned long)(h.maxC / mhz));
+}
+
+// `/hist`: dump every non-empty histogram, then reset them (reset-on-read).
+static void dumpHistograms(Print& out) {
+  static_assert(kProfStates == STATE_COUNT, "Profiler must have one frame histogram per ScreenState");
+  for (uint8_t i = 0; i < kProfStates; ++i) printHistLine("frame", kStateNames[i], gProf.frame[i], out);
+  for (uint8_t i = 0; i < PROF_COUNT; ++i) printHistLine("section", kProfNames[i], gProf.section[i], out);
+  out.println("[HIST] end");
+  for (uint8_t i = 0; i < kProfStates; ++i) gProf.frame[i] = CycleHist();
+  for (uint8_t i = 0; i < PROF_COUNT; ++i) gProf.section[i] = CycleHist();
+}
+
+// ===== Simulated-time run =====
+// Runs a private ScreenMachine on SimClock against a NullGfx sink, so a 60 s
+// wait plus the 13 s transition costs microseconds of real time. Optionally
+// injects a live message every msgEveryMs of simulated time. The content,
+// palette and governor it touches are restored afterwards. This runs on the
+// device only; there is no host build of the renderer.
+static void runSim(uint32_t cycles, uint32_t msgEveryMs, Print& out) {
+  TextRef liveText = std::move(gLiveText);
+  const bool hasLive = gHasLiveText;
+  const int philo = currentPhilo;
+  uint16_t colors[6];
+  uint8_t base[3];
+  memcpy(colors, gLineColors, sizeof(colors));
+  memcpy(base, gPaletteBase, sizeof(base));
+  const FrameGovernor gov = gGovernor;
+  gGovernor.logChanges = false;
+
+  SimClock clk;
+  NullGfx sink;
+  Adafruit_GFX* target = gfx;
+  gClock = &clk;
+  gfx = &sink;
+  gProf.on = false;
+  gTl.on = false;
+
+  ScreenMachine m;
+  m.sim = true;
+  m.start(STATE_WAIT_60S);
+  uint32_t injected = 0;
+  uint32_t nextMsg = msgEveryMs;
+  const uint32_t realT0 = micros();
+  while (m.cycles < cycles) {
+    bool fresh = false;
+    if (msgEveryMs && (int32_t)(clk.nowMs() - nextMsg) >= 0) {
+      gLiveText = textCopy("Simulated message\nfrom the host at\nsome steady rate.\n");
+      gHasLiveText = true;
+      fresh = true;
+      injected++;
+      nextMsg += msgEveryMs;
+    }
+    m.step(fresh);
+  }
+  const uint32_t realUs = micros() - realT0;
+
+  gClock = &gRealClock;
+  gfx = target;
+  gProf.on = true;
+  gTl.on = true;
+  gGovernor = gov;
+  memcpy(gLineColors, colors, sizeof(colors));
+  memcpy(gPaletteBase, base, sizeof(base));
+  gLiveText = std::move(liveText);
+  gHasLiveText = hasLive;
+  currentPhilo = philo;
+
+  const uint64_t simMs = clk.us / 1000ULL;
+  out.printf("[SIM] %lu cycles in %lu us real (%lu cycles/s), %lu s simulated (%lu ms/cycle)\n",
+             (unsigned long)cycles, (unsigned long)realUs,
+             (unsigned long)(realUs ? (uint64_t)cycles * 1000000ULL / realUs : 0),
+             (unsigned long)(simMs / 1000ULL), (unsigned long)(cycles ? simMs / cycles : 0));
+  out.printf("[SIM] messages injected=%lu shown=%lu (%lu/h)\n",
+             (unsigned long)injected, (unsigned long)m.liveShown,
+             (unsigned long)(simMs ? (uint64_t)m.liveShown * 3600000ULL / simMs : 0));
+  for (int i = 0; i < STATE_COUNT; ++i) {
+    out.printf("[SIM]   %-10s %lu ms/cycle\n", kStateNames[i], (unsigned long)(cycles ? m.stateMs[i] / cycles : 0));
+  }
+}
+
+// ===== Benchmarks =====
+// `/bench` times the rendering primitives on the real panel with the cycle
+// counter, then repeats each once against a CountingGfx to count pixels.
+// Allocations are counted by the ALLOC_HOOKS wrappers (0 without them).
+// Payloads are the canned sets plus a typical 6 x 19-char LLM message.
+static const char* const kBenchLlmText =
+  "Snowflakes settle\n"
+  "on quiet rooftops\n"
+  "while every window\n"
+  "glows with kindness\n"
+  "and warm cocoa for\n"
+  "friends old and new.";
+
+template <typename F>
+static void benchOp(const char* name, uint16_t iters, F fn, Print& out) {
+  const uint32_t a0 = allocCallsThisCore();
+  const uint32_t c0 = ESP.getCycleCount();
+  for (uint16_t i = 0; i < iters; ++i) fn();
+  const uint32_t cycles = ESP.getCycleCount() - c0;
+  const uint32_t allocs = allocCallsThisCore() - a0;
+
+  CountingGfx counter;
+  Adafruit_GFX* target = gfx;
+  gfx = &counter;
+  fn();
+  gfx = target;
+
+  const uint64_t ns = (uint64_t)cycles * 1000ULL / ESP.getCpuFreqMHz() / iters;
+  out.printf("[BENCH] %-24s %9lu ns %7lu px %5lu.%02lu allocs\n", name, (unsigned long)ns,
+             (unsigned long)counter.pixels, (unsigned long)(allocs / iters),
+             (unsigned long)(allocs * 100UL / iters % 100));
+}
+
+#if ENABLE_ASSETS
+static volatile uint32_t gAssetSink;
+
+// Word-by-word read of `n` bytes, in ns.
+static uint32_t assetReadNs(const uint8_t* p, uint32_t n) {
+  uint32_t sum = 0;
+  const uint32_t c0 = ESP.getCycleCount();
+  for (uint32_t i = 0; i + 4 <= n; i += 4) sum += *(const uint32_t*)(p + i);
+  const uint32_t cycles = ESP.getCycleCount() - c0;
+  gAssetSink = sum;
+  return (uint32_t)((uint64_t)cycles * 1000ULL / ESP.getCpuFreqMHz());
+}
+
+// Fill the 32 KB flash cache with another 64 KB of the partition so the next
+// read of `e` misses. False when the partition has no room beside it.
+static bool assetEvict(const AssetEntry* e) {
+  const uint32_t kWindow = 64UL * 1024UL;
+  uint32_t at = (e->offset + e->size + 0xFFFUL) & ~0xFFFUL;
+  if (at + kWindow > gAssetPartSize) {
+    if (e->offset < kWindow) return false;
+    at = 0;
+  }
+  assetReadNs(gAssetBase + at, kWindow);
+  return true;
+}
+
+// The first asset read cold and warm from flash and from a RAM copy, then
+// drawn both ways: what running from the mapping costs over copying to DRAM.
+static void benchAssets(uint16_t iters, Print& out) {
+  if (!gAssetHdr || !gAssetHdr->count) return;
+  const AssetEntry* e = assetTable();
+  const uint8_t* flash = gAssetBase + e->offset;
+  uint8_t* ram = (uint8_t*)malloc(e->size);
+  if (!ram) {
+    out.printf("[BENCH] asset/%s: no RAM for the copy (%lu B)\n", e->name, (unsigned long)e->size);
+    return;
+  }
+  memcpy(ram, flash, e->size);
+  const bool cold = assetEvict(e);
+  const uint32_t coldNs = assetReadNs(flash, e->size);
+  const uint32_t warmNs = assetReadNs(flash, e->size);
+  const uint32_t ramNs = assetReadNs(ram, e->size);
+  char name[32];
+  snprintf(name, sizeof(name), "asset/read/%.16s", e->name);
+  if (cold) {
+    out.printf("[BENCH] %-24s cold=%lu ns warm=%lu ns ram=%lu ns (%lu B)\n", name, (unsigned long)coldNs,
+               (unsigned long)warmNs, (unsigned long)ramNs, (unsigned long)e->size);
+  } else {
+    out.printf("[BENCH] %-24s warm=%lu ns ram=%lu ns (%lu B; no room to evict the cache)\n", name,
+               (unsigned long)warmNs, (unsigned long)ramNs, (unsigned long)e->size);
+  }
+  if (e->type == ASSET_BITMAP565) {
+    benchOp("asset/blit-flash", iters,
+            [&]() { gfx->drawRGBBitmap(0, 0, (const uint16_t*)flash, (int16_t)e->w, (int16_t)e->h); }, out);
+    benchOp("asset/blit-ram", iters,
+            [&]() { gfx->drawRGBBitmap(0, 0, (const uint16_t*)ram, (int16_t)e->w, (int16_t)e->h); }, out);
+  } else if (e->type == ASSET_FONT) {
+    GFXfont f, r;
+    assetFont(e, f);
+    r = f;
+    r.glyph = (GFXglyph*)(ram + ((const uint8_t*)f.glyph - flash));
+    r.bitmap = ram + (f.bitmap - flash);
+    auto glyphs = [](const GFXfont* font) {
+      gfx->setFont(font);
+      gfx->setCursor(0, 20);
+      gfx->print("Life is mostly fog");
+      gfx->setFont(nullptr);
+    };
+    benchOp("asset/glyphs-flash", iters, [&]() { glyphs(&f); }, out);
+    benchOp("asset/glyphs-ram", iters, [&]() { glyphs(&r); }, out);
+  }
+  free(ram);
+}
+#endif
+
+static void runBenchmarks(Print& out) {
+  uint16_t colors[6];
+  uint8_t base[3];
+  memcpy(colors, gLineColors, sizeof(colors));
+  memcpy(base, gPaletteBase, sizeof(base));
+  const FrameGovernor gov = gGovernor;
+  gGovernor.logChanges = false;
+  gProf.on = false;
+  gTl.on = false;
+
+  out.printf("[BENCH] %-24s %12s %10s %12s\n", "op", "per call", "pixels", "allocations");
+  const uint16_t kIters = 20;
+  char name[32];
+  for (int i = 0; i < kCannedChecked; ++i) {
+    snprintf(name, sizeof(name), "gradient/canned%d", i);
+    const char* text = kCannedText[i];
+    benchOp(name, kIters, [&]() { drawWrappedGradient(text, -1); }, out);
+  }
+  const char* llm = kBenchLlmText;
+  benchOp("gradient/llm6x19", kIters, [&]() { drawWrappedGradient(llm, -1); }, out);
+  const int32_t llmLen = (int32_t)visibleLength(llm);
+  benchOp("span/llm-last-char", kIters, [&]() { drawGradientSpan(llm, llmLen - 1, llmLen); }, out);
+  benchOp("thinking/cursor", kIters, [&]() { renderThining(true); }, out);
+  benchOp("palette/fromBase", kIters, [&]() { makePaletteFromBase(200, 60, 255); }, out);
+  #if INDEXED_FB
+  // What a palette change costs in place, against redrawing the message above
+  drawWrappedGradient(llm, -1);
+  benchOp("palette/recolour", kIters, [&]() { gIndexed.recolour(gfx == &gIndexed ? *gIndexed.target : *gfx); }, out);
+  #endif
+  // duration 0: every tile goes in a single frame, i.e. the raw fill cost
+  for (uint8_t block = 4; block <= 10; block += 2) {
+    snprintf(name, sizeof(name), "dissolve/%upx", block);
+    benchOp(name, 4, [&]() { dissolveClearBlocks((uint16_t)gfx->width(), (uint16_t)gfx->height(), 0, block); }, out);
+  }
+  #if ENABLE_ASSETS
+  benchAssets(kIters, out);
+  #endif
+  out.println("[BENCH] end");
+
+  gGovernor = gov;
+  gProf.on = true;
+  gTl.on = true;
+  memcpy(gLineColors, colors, sizeof(colors));
+  memcpy(gPaletteBase, base, sizeof(base));
+  drawSixLines();
+}
+
+// ===== Golden frames =====
+// `/golden record` renders a fixed set of scenarios (every canned set, a
+// typical LLM payload, each transition stage) into an off-screen ShadowGfx
+// with a fixed palette and seed, and stores each frame's hash and draw cost
+// in NVS. `/golden` re-renders and fails any scenario whose pixels changed,
+// or whose cost went over its budget: pixels touched and draw calls may not
+// grow at all, time may grow by GOLDEN_TIME_SLACK_PCT. Record on the board
+// and library versions you ship; the hashes depend on both.
+#ifndef GOLDEN_TIME_SLACK_PCT
+#define GOLDEN_TIME_SLACK_PCT 25
+#endif
+
+// Keeps the final frame so it can be hashed, and counts what the renderer sends.
+class ShadowGfx : public Adafruit_GFX {
+ public:
+  uint16_t* fb = nullptr;
+  uint32_t pixels = 0, calls = 0;
+  ShadowGfx() : Adafruit_GFX(PANEL_RES_X * PANEL_CHAIN, PANEL_RES_Y) {
+    fb = (uint16_t*)calloc((size_t)width() * height(), sizeof(uint16_t));
+  }
+  ~ShadowGfx() { free(fb); }
+  void drawPixel(int16_t x, int16_t y, uint16_t c) override {
+    calls++;
+    if (x < 0 || y < 0 || x >= width() || y >= height()) return;
+    fb[y * width() + x] = c;
+    pixels++;
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c) override {
+    calls++;
+    int16_t x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+    int16_t x1 = x + w > width() ? width() : x + w, y1 = y + h > height() ? height() : y + h;
+    for (int16_t yy = y0; yy < y1; ++yy) {
+      for (int16_t xx = x0; xx < x1; ++xx) { fb[yy * width() + xx] = c; pixels++; }
+    }
+  }
+  void fillScreen(uint16_t c) override { fillRect(0, 0, width(), height(), c); }
+  uint32_t hash() const {
+    uint32_t h = 2166136261UL;   // FNV-1a over the frame
+    const uint8_t* p = (const uint8_t*)fb;
+    for (size_t i = 0; i < (size_t)width() * height() * 2; ++i) { h ^= p[i]; h *= 16777619UL; }
+    return h;
+  }
+};
+
+struct GoldenEntry {
+  uint32_t hash;
+  uint32_t pixels;
+  uint32_t calls;
+  uint32_t us;
+};
+static const uint8_t kGoldenFixed = 6;   // scenarios after the canned sets
+static const uint8_t kGoldenMax = kCannedChecked + kGoldenFixed;
+
+static void goldenName(uint8_t i, char* buf, size_t n) {
+  static const char* const kFixed[kGoldenFixed] = {
+    "llm/full", "typewriter/half", "typewriter/step", "thinking/on", "thinking/off", "dissolve/4px",
+  };
+  if (i < kCannedChecked) snprintf(buf, n, "canned%u", i);
+  else snprintf(buf, n, "%s", kFixed[i - kCannedChecked]);
+}
+
+// `prepare` sets up the frame the scenario starts from; only the draw that
+// follows it is measured.
+static void goldenRender(uint8_t i, bool prepare, const char* llm) {
+  const int32_t half = (int32_t)visibleLength(llm) / 2;
+  if (i < kCannedChecked) {
+    if (!prepare) drawWrappedGradient(kCannedText[i], -1);
+    return;
+  }
+  switch (i - kCannedChecked) {
+    case 0: if (!prepare) drawWrappedGradient(llm, -1); break;
+    case 1: if (!prepare) drawWrappedGradient(llm, half); break;
+    case 2: if (prepare) drawWrappedGradient(llm, half); else drawGradientSpan(llm, half, half + 1); break;
+    case 3: if (!prepare) renderThining(true); break;
+    case 4: if (!prepare) renderThining(false); break;
+    case 5:
+      if (prepare) drawWrappedGradient(llm, -1);
+      else dissolveClearBlocks((uint16_t)gfx->width(), (uint16_t)gfx->height(), 0, 4);
+      break;
+  }
+}
+
+// Render scenario `i`; the time is the best of a few runs.
+static bool goldenMeasure(uint8_t i, const char* llm, GoldenEntry& e) {
+  ShadowGfx shadow;
+  if (!shadow.fb) return false;
+  Adafruit_GFX* target = gfx;
+  gfx = &shadow;
+  e.us = UINT32_MAX;
+  for (uint8_t rep = 0; rep < 5; ++rep) {
+    shadow.fillScreen(0);
+    randomSeed(0x601D);
+    goldenRender(i, true, llm);
+    shadow.pixels = shadow.calls = 0;
+    const uint32_t c0 = ESP.getCycleCount();
+    goldenRender(i, false, llm);
+    const uint32_t us = (ESP.getCycleCount() - c0) / ESP.getCpuFreqMHz();
+    if (us < e.us) e.us = us;
+  }
+  gfx = target;
+  e.hash = shadow.hash();
+  e.pixels = shadow.pixels;
+  e.calls = shadow.calls;
+  return true;
+}
+
+static void runGolden(bool record, Print& out) {
+  uint16_t colors[6];
+  uint8_t base[3];
+  memcpy(colors, gLineColors, sizeof(colors));
+  memcpy(base, gPaletteBase, sizeof(base));
+  const FrameGovernor gov = gGovernor;
+  gGovernor.logChanges = false;
+  gProf.on = false;
+  gTl.on = false;
+  gGovernor.quality = 0;
+  makePaletteFromBase(200, 60, 255);
+
+  const uint8_t n = (uint8_t)(kCannedChecked + kGoldenFixed);
+  static GoldenEntry saved[kGoldenMax];
+  Preferences prefs;
+  prefs.begin("golden", !record);
+  const bool have = !record && prefs.getBytes("frames", saved, sizeof(saved)) == sizeof(saved) &&
+                    prefs.getUChar("count", 0) == n;
+  if (!record && !have) out.println("[GOLDEN] no baseline for this scenario set; run /golden record");
+
+  const char* llm = kBenchLlmText;
+  uint8_t failed = 0;
+  char name[24];
+  for (uint8_t i = 0; i < n; ++i) {
+    GoldenEntry e;
+    goldenName(i, name, sizeof(name));
+    if (!goldenMeasure(i, llm, e)) {
+      out.println("[GOLDEN] out of memory for the shadow frame");
+      failed++;
+      break;
+    }
+    out.printf("[GOLDEN] %-16s hash=%08lx px=%6lu calls=%6lu us=%6lu", name, (unsigned long)e.hash,
+               (unsigned long)e.pixels, (unsigned long)e.calls, (unsigned long)e.us);
+    if (record) {
+      saved[i] = e;
+      out.println();
+      continue;
+    }
+    if (!have) { out.println(); continue; }
+    const GoldenEntry& g = saved[i];
+    const uint32_t usBudget = g.us + g.us * GOLDEN_TIME_SLACK_PCT / 100 + 1;
+    if (e.hash != g.hash) out.printf("  FAIL pixels changed (was %08lx)\n", (unsigned long)g.hash);
+    else if (e.pixels > g.pixels) out.printf("  FAIL px over budget %lu\n", (unsigned long)g.pixels);
+    else if (e.calls > g.calls) out.printf("  FAIL calls over budget %lu\n", (unsigned long)g.calls);
+    else if (e.us > usBudget) out.printf("  FAIL time over budget %lu us\n", (unsigned long)usBudget);
+    else { out.println("  ok"); continue; }
+    failed++;
+  }
+  if (record) {
+    prefs.putBytes("frames", saved, sizeof(saved));
+    prefs.putUChar("count", n);
+    out.printf("[GOLDEN] recorded %u scenarios\n", n);
+  } else if (have) {
+    out.printf("[GOLDEN] %s: %u of %u scenarios failed\n", failed ? "FAIL" : "PASS", failed, n);
+  }
+  prefs.end();
+
+  randomSeed((uint32_t)micros());
+  gGovernor = gov;
+  gProf.on = true;
+  gTl.on = true;
+  memcpy(gLineColors, colors, sizeof(colors));
+  memcpy(gPaletteBase, base, sizeof(base));
+  drawSixLines();
+}
+
+// ===== Commands =====
+// A message whose first character is '/' is a command instead of text to show.
+//   /sim [cycles] [msg_every_s]  run the state machine on simulated time
+//   /stalls [reset]              loop stall report (or clear it)
+//   /hist                        frame/section time histograms (reset on read)
+//   /trace                       latency breakdown of the last live messages
+//   /bench                       time the rendering primitives
+//   /heap                        heap, fragmentation and allocation counts
+//   /panel [sweep]               refresh/DMA figures (or sweep the I2S clock)
+//   /ble                         BLE link parameters, throughput, disconnects
+//   /golden [record]             check rendered frames against the stored baseline
+//   /timeline                    dump the event timeline (src/timeline_to_perfetto.py)
+//   /store [clear]               message store size and flash use (or wipe it)
+//   /assets                      list the mapped flash assets
+//   /palette                     new random palette, applied without redrawing
+static void handleCommand(const char* line, Print& out) {
+  AllocScope tag(ALLOC_CMD);
+  char cmd[64];
+  while (isspace((unsigned char)*line)) line++;
+  size_t n = strlcpy(cmd, line, sizeof(cmd));
+  if (n > sizeof(cmd) - 1) n = sizeof(cmd) - 1;
+  while (n && isspace((unsigned char)cmd[n - 1])) cmd[--n] = 0;
+  if (!strcmp(cmd, "/palette")) {
+    #if INDEXED_FB
+    randomizePalette();
+    const uint32_t c0 = ESP.getCycleCount();
+    const uint32_t px = gIndexed.recolour(*gIndexed.target);
+    out.printf("[PALETTE] recoloured %lu px in %lu us (%u B index map)\n", (unsigned long)px,
+               (unsigned long)((ESP.getCycleCount() - c0) / ESP.getCpuFreqMHz()), (unsigned)sizeof(gIndexed.map));
+    #else
+    randomizePalette();
+    drawSixLines();
+    out.println("[PALETTE] redrawn (build with INDEXED_FB=1 to recolour in place)");
+    #endif
+  } else if (!strcmp(cmd, "/assets")) {
+    #if ENABLE_ASSETS
+    printAssets(out);
+    #else
+    out.println("[ASSET] disabled (build with ENABLE_ASSETS=1)");
+    #endif
+  } else if (!strcmp(cmd, "/store") || !strcmp(cmd, "/store clear")) {
+    #if ENABLE_STORE
+    if (cmd[6]) clearStore(out);
+    else printStore(out);
+    #else
+    out.println("[STORE] disabled (build with ENABLE_STORE=1)");
+    #endif
+  } else if (!strcmp(cmd, "/timeline")) {
+    dumpTimeline(out);
+  } else if (!strcmp(cmd, "/golden record")) {
+    runGolden(true, out);
+  } else if (!strcmp(cmd, "/golden")) {
+    runGolden(false, out);
+  } else if (!strcmp(cmd, "/ble")) {
+    #if ENABLE_BT
+    printBleStats(out);
+    #else
+    out.println("[BLE] disabled in this build");
+    #endif
+  } else if (!strcmp(cmd, "/panel sweep")) {
+    startPanelSweep(out);
+  } else if (!strcmp(cmd, "/panel")) {
+    printPanelReport(out);
+    printPanelSweep(out);
+  } else if (!strcmp(cmd, "/heap")) {
+    printTextPool(out);
+    printHeapReport(out);
+  } else if (!strcmp(cmd, "/bench")) {
+    runBenchmarks(out);
+  } else if (!strcmp(cmd, "/trace")) {
+    printTraces(out);
+  } else if (!strcmp(cmd, "/hist")) {
+    dumpHistograms(out);
+  } else if (!strcmp(cmd, "/stalls reset")) {
+    gLoopMon.reset();
+    out.println("[STALL] reset");
+  } else if (!strncmp(cmd, "/stalls", 7)) {
+    printStalls(out);
+  } else if (!strncmp(cmd, "/sim", 4)) {
+    unsigned long cycles = 100, everyS = 0;
+    sscanf(cmd, "/sim %lu %lu", &cycles, &everyS);
+    if (cycles == 0) cycles = 1;
+    runSim((uint32_t)cycles, (uint32_t)everyS * 1000UL, out);
+  } else {
+    out.printf("[CMD] unknown command: %s\n", cmd);
+  }
+}
+
+// ===== Boot timeline =====
+// Phase stamps are micros() since the esp_timer started, i.e. roughly since reset.
+static uint32_t gBootLastUs = 0;
+
+static void bootMark(const char* phase) {
+  uint32_t now = micros();
+  Serial.printf("[BOOT] %-12s at %7lu us (+%lu us)\n", phase, (unsigned long)now,
+                (unsigned long)(now - gBootLastUs));
+  gBootLastUs = now;
+}
+
+#if ENABLE_BT
+// Bring BLE up on core 0 so advertising starts while the panel is already drawing.
+static void bleInitTask(void* /*arg*/) {
+  uint32_t t0 = micros();
+  initBLE();
+  gBleReady = true;
+  Serial.printf("[BOOT] %-12s at %7lu us (init %lu us, off the loop task)\n", "ble_ready",
+                (unsigned long)micros(), (unsigned long)(micros() - t0));
+  if (Serial) Serial.println("[BLE] setup complete; scanning from a phone or Mac should show 'MatrixPanel'.");
+  vTaskDelete(nullptr);
+}
+#endif
+
+#if ENABLE_WIFI
+static void onWiFiGotIP(arduino_event_id_t /*event*/, arduino_event_info_t /*info*/) {
+  wakeLoop();
+}
+
+// Start association in the background; loop() picks up the result via pollWiFi().
+static void beginWiFi() {
+  WiFi.mode(WIFI_STA);
+  WiFi.onEvent(onWiFiGotIP, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.begin(WIFI_SSID, WIFI_PASS);
+}
+
+// Returns true once, on the first poll after the station has an IP.
+static bool pollWiFi() {
+  static bool connected = false;
+  static bool warned = false;
+  if (connected) return false;
+  if (WiFi.status() != WL_CONNECTED) {
+    if (!warned && millis() > 15000UL) {
+      warned = true;
+      Serial.println("Wi-Fi not connected after 15 s (still trying; BT will still work).");
+    }
+    return false;
+  }
+  connected = true;
+  bootMark("wifi_up");
+  Serial.print("ESP32 IP: ");
+  Serial.println(WiFi.localIP());
+  #if ENABLE_HTTP_SERVER
+  server.begin();
+  #endif
+  return true;
+}
+
+// Show the IP full-screen; loop() restores the message when the overlay expires.
+static void drawIpOverlay() {
+  gfx->fillScreen(0);
+  gfx->setCursor(0, 0);
+  gfx->setTextColor(color565(255, 255, 255));
+  gfx->print("IP: ");
+  gfx->println(WiFi.localIP());
+}
+#endif
+
+void setup() {
+  Serial.begin(115200);
+  randomSeed((uint32_t)micros());
+  gLoopTask = xTaskGetCurrentTaskHandle();
+  Serial.onReceive([]() { wakeLoop(); }); // UART bytes end an idle wait early
+  bootMark("serial");
+  textPoolInit();
+
+  initPanel(panelBootSpeed());
+  dma_display->setBrightness8(kTargetBrightness);
+  dma_display->fillScreen(0);
+  #if INDEXED_FB
+  gIndexed.target = dma_display;
+  gfx = &gIndexed;
+  #else
+  gfx = dma_display;
+  #endif
+  bootMark("panel");
+
+  // Redraw what was up before a reset, or pick a random starting set and draw
+  const bool warm = warmRestore();
+  if (!warm) {
+    randomizePalette();
+    currentPhilo = random(kNumPhilos);
+  }
+  #if ENABLE_ASSETS
+  assetsBegin();   // just a mapping; the first frame may already use its text font
+  #endif
+  drawSixLines();
+  bootMark(warm ? "warm_frame" : "first_frame");
+  if (panelSweepRunning()) panelSweepStep();
+
+  // Bluetooth BLE (NimBLE UART / NUS) comes up on core 0 after the first
+  // frame. The rest of setup waits for it: Wi-Fi, the HTTP server and the
+  // store all allocate, and initBLE's heap figure must only see the stack's.
+  #if ENABLE_BT
+  xTaskCreatePinnedToCore(bleInitTask, "ble_init", 6144, nullptr, 1, nullptr, 0);
+  const uint32_t bleWaitMs = millis();
+  while (!gBleReady && millis() - bleWaitMs < 5000UL) delay(1);
+  if (!gBleReady) Serial.println("[BLE] init still running; its stack heap figure may include other allocations");
+  #endif
+
+  // --- Wi-Fi station bring-up (associates in the background) ---
+  #if ENABLE_WIFI
+  beginWiFi();
+  #endif
+
+// --- HTTP endpoint ---
+  #if ENABLE_HTTP_SERVER
+  server.on("/post", HTTP_POST, handlePost);
+  server.on("/trace", HTTP_GET, handleTraceGet);
+  #if !ENABLE_WIFI
+  server.begin();
+  #endif
+  #endif
+
+  // Index the message store after the first frame so it does not delay it
+  #if ENABLE_STORE
+  storeBegin();
+  bootMark("store");
+  #endif
+
+  // A warm start already shows the finished frame, so resume from the hold
+  gScreen.start(warm ? STATE_DONE : STATE_WAIT_60S);
+  bootMark("setup_done");
+  #if STATIC_ALLOC
+  gHeapTrap.core = (uint8_t)xPortGetCoreID();
+  gHeapTrap.armed = true;
+  #endif
+}
+
+void loop() {
+  gLoopMon.begin();
+  #if ENABLE_HTTP_SERVER
+  { SectionTimer t(SEC_HTTP); AllocScope tag(ALLOC_HTTP); server.handleClient(); }
+  #endif
+  { SectionTimer t(SEC_USB); processUSB(); }
+  #if ENABLE_BT
+  { SectionTimer t(SEC_BLE); processBluetooth(); }
+  bleStatsTick(gScreen.state == STATE_WAIT_60S || gScreen.state == STATE_DONE);
+  #endif
+  idleReport();
+  heapTick();
+
+  #if ENABLE_WIFI
+  {
+    SectionTimer t(SEC_WIFI);
+    if (pollWiFi() && gScreen.state == STATE_WAIT_60S) {
+      drawIpOverlay();
+      gScreen.ipOverlayUntil = (gClock->nowMs() + 5000UL) | 1UL; // never 0 while active
+    }
   }
+  #endif
+
+  // Check Bluetooth; if new text, start dissolve immediately
+  const bool fresh = kNewLivePending;
+  if (fresh) {
+    kNewLivePending = false;
+    TextRef text = textTakePending();
+    if (text) {
+      gLiveText = std::move(text);   // the buffer it replaces goes back to the pool
+      gHasLiveText = true;
+      #if ENABLE_STORE
+      SectionTimer t(SEC_STORE);
+      storeAppend(gLiveText.c_str(), gLiveText.length(), (uint8_t)(1u << gRxVia));
+      #endif
+    }
+    gScreen.wokeUs = gWakeStampUs ? gWakeStampUs : micros();
+    traceBegin();
+  }
+  gWakeStampUs = 0;
+
+  const uint8_t state = (uint8_t)(fresh ? STATE_DISSOLVING : gScreen.state);
+  { SectionTimer t(SEC_SCREEN); gScreen.step(fresh); }
+  #if ENABLE_STORE
+  if (gScreen.state == STATE_WAIT_60S) { SectionTimer t(SEC_STORE); storeMaintain(); }
+  #endif
+  if (gScreen.state != state) tlEvent(TL_STATE, TL_INSTANT, gScreen.state);
+  if (const StallRecord* r = gLoopMon.end(state)) logStall(*r, Serial);
 }
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Build the image for the firmware's memory-mapped "assets" partition.
+
+The firmware maps the partition through the flash MMU and draws straight
+from it (see "Flash assets" in main.cpp), so the layout here must match
+AssetHeader / AssetEntry / AssetFontHeader there:
+
+  header   magic "PPA1", count u16, reserved u16, used bytes u32
+  entries  count x 32 B: name[16], type u8, pad u8, w u16, h u16, pad u16,
+           offset u32, size u32      (offsets from the partition start)
+  payloads 4-byte aligned
+    bitmap  RGB565 little-endian, w*h*2 bytes           (w, h = pixels)
+    font    first u16, last u16, yAdvance u8, pad[3], then one 8-byte
+            GFXglyph per char, then the glyph bitmaps   (w, h = first, last)
+    blob    raw bytes
+
+  python3 src/pack_assets.py -o assets.bin --bitmap thinking=thinking.png \\
+      --font small=FreeSans9pt7b.h --blob quotes=quotes.txt
+  python3 src/pack_assets.py ... --flash --port /dev/cu.usbserial-0001
+
+Bitmaps need Pillow; fonts are Adafruit GFX font headers (fontconvert output).
+A font named "text" (at most 10 px yAdvance, about 6 px wide to match the host's
+wrapping) is what the firmware draws messages with.
+"""
+import argparse
+import csv
+import os
+import re
+import struct
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MAGIC = 0x31415050   # "PPA1"
+HEADER = struct.Struct("<IHHI")
+ENTRY = struct.Struct("<16sBBHHHII")
+GLYPH = struct.Struct("<HBBBbbx")   # GFXglyph with its trailing pad byte
+TYPES = {"blob": 0, "bitmap": 1, "font": 2}
+
+
+def align4(n: int) -> int:
+    return (n + 3) & ~3
+
+
+def load_bitmap(path: str):
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("bitmaps need Pillow: pip install pillow")
+    im = Image.open(path).convert("RGB")
+    out = bytearray()
+    for r, g, b in im.getdata():
+        out += struct.pack("<H", ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
+    return bytes(out), im.width, im.height
+
+
+def load_font(path: str):
+    src = open(path, errors="replace").read()
+    src = re.sub(r"//[^\n]*", "", src)
+    bitmaps = re.search(r"Bitmaps\[\]\s*PROGMEM\s*=\s*\{(.*?)\};", src, re.S)
+    glyphs = re.search(r"Glyphs\[\]\s*PROGMEM\s*=\s*\{(.*?)\};", src, re.S)
+    font = re.search(r"GFXfont\s+\w+\s*PROGMEM\s*=\s*\{(.*?)\};", src, re.S)
+    if not (bitmaps and glyphs and font):
+        sys.exit(f"{path}: not an Adafruit GFX font header")
+    bits = bytes(int(x, 0) for x in re.findall(r"0x[0-9A-Fa-f]+|\d+", bitmaps.group(1)))
+    table = [tuple(int(v, 0) for v in g.split(","))
+             for g in re.findall(r"\{\s*([-\dxA-Fa-f,\s]+?)\s*\}", glyphs.group(1))]
+    first, last, y_adv = (int(v, 0) for v in font.group(1).split(",")[2:5])
+    if len(table) != last - first + 1:
+        sys.exit(f"{path}: {len(table)} glyphs for chars {first}..{last}")
+    payload = struct.pack("<HHB3x", first, last, y_adv)
+    payload += b"".join(GLYPH.pack(*g) for g in table) + bits
+    return payload, first, last
+
+
+def build(assets):
+    """assets: [(name, type, payload, w, h)] -> image bytes."""
+    table_end = HEADER.size + ENTRY.size * len(assets)
+    offset = align4(table_end)
+    entries, blobs = [], []
+    for name, kind, payload, w, h in assets:
+        if len(name.encode()) > 16:
+            sys.exit(f"asset name {name!r} longer than 16 bytes")
+        entries.append(ENTRY.pack(name.encode(), TYPES[kind], 0, w, h, 0, offset, len(payload)))
+        blobs.append((offset, payload))
+        offset = align4(offset + len(payload))
+    image = bytearray(b"\xff" * offset)   # erased flash is 0xFF
+    image[:HEADER.size] = HEADER.pack(MAGIC, len(assets), 0, offset)
+    image[HEADER.size:table_end] = b"".join(entries)
+    for at, payload in blobs:
+        image[at:at + len(payload)] = payload
+    return bytes(image)
+
+
+def partition(name: str):
+    with open(os.path.join(ROOT, "partitions.csv")) as f:
+        rows = [r for r in csv.reader(line for line in f if not line.lstrip().startswith("#"))]
+    for r in rows:
+        if r and r[0].strip() == name:
+            return int(r[3], 0), int(r[4], 0)
+    sys.exit(f"no {name!r} partition in partitions.csv")
+
+
+def parse_spec(spec: str):
+    name, sep, path = spec.partition("=")
+    if not sep:
+        sys.exit(f"expected NAME=FILE, got {spec!r}")
+    return name, path
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--bitmap", action="append", default=[], metavar="NAME=IMAGE")
+    ap.add_argument("--font", action="append", default=[], metavar="NAME=FONT.h")
+    ap.add_argument("--blob", action="append", default=[], metavar="NAME=FILE")
+    ap.add_argument("-o", "--output", default="assets.bin")
+    ap.add_argument("--flash", action="store_true", help="write the image with esptool")
+    ap.add_argument("--port", help="serial port for --flash")
+    args = ap.parse_args()
+
+    assets = []
+    for spec in args.bitmap:
+        name, path = parse_spec(spec)
+        data, w, h = load_bitmap(path)
+        assets.append((name, "bitmap", data, w, h))
+    for spec in args.font:
+        name, path = parse_spec(spec)
+        data, first, last = load_font(path)
+        assets.append((name, "font", data, first, last))
+    for spec in args.blob:
+        name, path = parse_spec(spec)
+        with open(path, "rb") as f:
+            assets.append((name, "blob", f.read(), 0, 0))
+
+    image = build(assets)
+    offset, size = partition("assets")
+    if len(image) > size:
+        sys.exit(f"image is {len(image)} B, the assets partition holds {size} B")
+    with open(args.output, "wb") as f:
+        f.write(image)
+    for name, kind, payload, w, h in assets:
+        print(f"  {name:16s} {kind:6s} {w}x{h} {len(payload)} B")
+    print(f"{len(assets)} assets, {len(image)}/{size} B -> {args.output} (flash at 0x{offset:x})")
+
+    if args.flash:
+        cmd = [sys.executable, "-m", "esptool", "--chip", "esp32"]
+        if args.port:
+            cmd += ["--port", args.port]
+        subprocess.run(cmd + ["write_flash", hex(offset), args.output], check=True)
+
+
+if __name__ == "__main__":
+    main()
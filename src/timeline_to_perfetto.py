@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Convert a firmware `/timeline` dump into Chrome trace-event JSON.
+
+Open the result in chrome://tracing or https://ui.perfetto.dev. Each task
+that logged events is a thread track; loop sections, render calls, frames,
+idle waits and BLE writes are slices, message receipt and state changes are
+instant markers.
+
+  # capture straight from the board (sends /timeline and reads the reply)
+  python3 timeline_to_perfetto.py --port /dev/cu.usbserial-0001 -o cycle.json
+  # or convert a saved serial log that contains a dump
+  python3 timeline_to_perfetto.py serial.log -o cycle.json
+"""
+import argparse
+import json
+import sys
+import time
+
+STATE_NAMES = ["wait", "dissolve", "pause", "thinking", "typewriter", "done"]
+PHASES = {0: "B", 1: "E", 2: "i"}
+
+
+def read_dump(lines):
+    """Return (names, tasks, events) from the last complete [TL] block."""
+    block, cur = None, None
+    for raw in lines:
+        line = raw.strip()
+        i = line.find("[TL] ")
+        if i < 0:
+            continue
+        body = line[i + 5:]
+        if body.startswith("begin"):
+            cur = []
+        elif body == "end":
+            if cur is not None:
+                block = cur
+            cur = None
+        elif cur is not None:
+            cur.append(body)
+    if block is None:
+        sys.exit("no complete [TL] begin ... [TL] end block found")
+
+    names, tasks, events = [], {}, []
+    for body in block:
+        if body.startswith("names"):
+            names = body.split()[1:]
+        elif body.startswith("tasks"):
+            for item in body.split()[1:]:
+                idx, _, name = item.partition(":")
+                tasks[int(idx)] = name
+        else:
+            for k in range(0, len(body) - 15, 16):
+                h = body[k:k + 16]
+                events.append((int(h[0:8], 16), int(h[8:10], 16), int(h[10:12], 16), int(h[12:16], 16)))
+    return names, tasks, events
+
+
+def to_chrome(names, tasks, events):
+    out = [{"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "philosophy_panel"}}]
+    for idx, name in tasks.items():
+        out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": idx, "args": {"name": name}})
+
+    base, wraps, prev = None, 0, None
+    open_slices = {}   # (tid, name) -> depth, to drop ends whose begin fell off the ring
+    for us, name_id, phase_task, arg in events:
+        # micros() wraps every ~71 minutes; events are in ring order, so unwrap on big backward jumps
+        if prev is not None and prev - us > 0x80000000:
+            wraps += 1
+        prev = us
+        ts = us + (wraps << 32)
+        if base is None:
+            base = ts
+        phase, tid = PHASES.get(phase_task >> 6, "i"), phase_task & 0x3F
+        name = names[name_id] if name_id < len(names) else f"ev{name_id}"
+        ev = {"name": name, "ph": phase, "ts": ts - base, "pid": 1, "tid": tid}
+        key = (tid, name)
+        if phase == "B":
+            open_slices[key] = open_slices.get(key, 0) + 1
+        elif phase == "E":
+            if not open_slices.get(key):
+                continue
+            open_slices[key] -= 1
+        else:
+            ev["s"] = "t"
+            if name == "state":
+                ev["name"] = "state:" + (STATE_NAMES[arg] if arg < len(STATE_NAMES) else str(arg))
+            elif name == "rx":
+                ev["args"] = {"seq": arg}
+        out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def capture(port: str, baud: int, timeout: float):
+    import serial
+    with serial.Serial(port, baud, timeout=0.5) as ser:
+        try:
+            ser.dtr = False  # avoid auto-reset on USB-UART bridges
+            ser.rts = False
+        except Exception:
+            pass
+        ser.reset_input_buffer()
+        ser.write(b"/timeline\n")
+        lines, deadline = [], time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            line = ser.readline().decode("ascii", "ignore")
+            if line:
+                lines.append(line)
+                if line.strip().endswith("[TL] end"):
+                    break
+        return lines
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("log", nargs="?", help="serial log containing a dump (default: stdin)")
+    ap.add_argument("--port", help="serial port to request a dump from")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--timeout", type=float, default=20.0)
+    ap.add_argument("-o", "--output", default="timeline.json")
+    args = ap.parse_args()
+
+    if args.port:
+        lines = capture(args.port, args.baud, args.timeout)
+    elif args.log:
+        with open(args.log, errors="replace") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+    names, tasks, events = read_dump(lines)
+    with open(args.output, "w") as f:
+        json.dump(to_chrome(names, tasks, events), f)
+    span = (events[-1][0] - events[0][0]) & 0xFFFFFFFF if events else 0
+    print(f"{len(events)} events over {span / 1000:.3f} ms from {len(tasks)} tasks -> {args.output}")
+
+
+if __name__ == "__main__":
+    main()